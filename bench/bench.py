@@ -0,0 +1,103 @@
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+
+bench = os.path.dirname(os.path.realpath(__file__))
+root = os.path.dirname(bench)
+
+parser = argparse.ArgumentParser(description='Run the krrp benchmark suite.')
+parser.add_argument('--krrp', default=os.path.join(root, 'krrp'), help='interpreter binary')
+parser.add_argument('--warmup', type=int, default=1, help='untimed runs per workload')
+parser.add_argument('--repetitions', type=int, default=5, help='timed runs per workload')
+parser.add_argument('--output', default=os.path.join(bench, 'results.json'), help='where to write the results')
+parser.add_argument('--baseline', default=os.path.join(bench, 'baseline.json'), help='results to compare against')
+parser.add_argument('--threshold', type=float, default=0.10, help='tolerated relative slowdown')
+parser.add_argument('--save-baseline', action='store_true', help='store the results as the new baseline')
+parser.add_argument('workloads', nargs='*', help='workload names (default: all of bench/*.krrp)')
+args = parser.parse_args()
+
+
+def run(workload):
+    """Run a workload once; returns wall time (s), peak RSS (KiB) and memory counters."""
+    with tempfile.TemporaryFile() as log:
+        start = time.perf_counter()
+        process = subprocess.Popen([args.krrp, '--memstats', '--noinfo', workload],
+            stdout=subprocess.DEVNULL, stderr=log)
+        _, status, rusage = os.wait4(process.pid, 0)
+        wall = time.perf_counter() - start
+
+        log.seek(0)
+        stderr = log.read().decode(errors='replace')
+
+    if os.waitstatus_to_exitcode(status) != 0:
+        sys.exit('bench: %s failed:\n%s' % (workload, stderr))
+
+    counters = json.loads(stderr.strip().splitlines()[-1])
+    return wall, rusage.ru_maxrss, counters
+
+
+workloads = args.workloads or sorted(
+    os.path.splitext(filename)[0] for filename in os.listdir(bench) if filename.endswith('.krrp'))
+
+results = {}
+for name in workloads:
+    workload = os.path.join(bench, name + '.krrp')
+    for _ in range(args.warmup):
+        run(workload)
+
+    walls, rss = [], 0
+    for _ in range(args.repetitions):
+        wall, maxrss, counters = run(workload)
+        walls.append(wall)
+        rss = max(rss, maxrss)
+
+    results[name] = {
+        'wall_median_s': statistics.median(walls),
+        'wall_min_s': min(walls),
+        'wall_max_s': max(walls),
+        'peak_rss_kib': rss,
+        'memory': counters,
+    }
+    print('%-10s %8.1f ms  %8d KiB  %10d allocations' % (
+        name, 1000 * results[name]['wall_median_s'], rss, counters['allocations']))
+
+with open(args.output, 'w') as f:
+    json.dump(results, f, indent=4, sort_keys=True)
+
+if args.save_baseline:
+    with open(args.baseline, 'w') as f:
+        json.dump(results, f, indent=4, sort_keys=True)
+    print('bench: saved baseline to %s' % args.baseline)
+    sys.exit()
+
+if not os.path.exists(args.baseline):
+    print('bench: no baseline at %s (create one with `make bench-baseline`)' % args.baseline)
+    sys.exit()
+
+with open(args.baseline) as f:
+    baseline = json.load(f)
+
+regressions = []
+for name, result in results.items():
+    if name not in baseline:
+        continue
+
+    before, after = baseline[name]['wall_median_s'], result['wall_median_s']
+    change = (after - before) / before if before > 0 else 0
+    print('%-10s %+7.1f %% wall time vs. baseline' % (name, 100 * change))
+
+    if change > args.threshold:
+        regressions.append(name)
+
+    before, after = baseline[name]['memory']['allocations'], result['memory']['allocations']
+    if before > 0 and (after - before) / before > args.threshold:
+        regressions.append(name + ' (allocations)')
+
+if regressions:
+    sys.exit('bench: regressions beyond %d %%: %s' % (100 * args.threshold, ', '.join(regressions)))
@@ -0,0 +1,223 @@
+// krrp component microbenchmarks; linked against the interpreter's objects
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "atom.h"
+#include "atomlist.h"
+#include "parse.h"
+#include "util.h"
+#include "memorymanagement.h"
+
+#include "Opt.h"
+extern Opt GlobOpt;
+
+
+/* Every experiment is run for doubling sizes n; it reports the time per
+   operation and the growth exponent between consecutive sizes, i.e. the k in
+   t(n) ~ n^k. An operation expected to be constant-time (k ~ 0) or linear
+   (k ~ 1) whose exponent over the whole range is notably larger is flagged. */
+
+#define SIZES 6
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long Unique = 0;
+static Atom *fresh_name() {
+    char *name = mm_malloc("microbench", 32);
+    sprintf(name, "]microbench%ld", Unique++);
+    return atom_name_new(name);
+}
+
+static integer fresh_integer() {
+    return 1000000000L + Unique++;
+}
+
+static void report(const char *experiment, double expected, long base, double (*run)(long n)) {
+    printf("%s\n", experiment);
+    printf("    %8s %14s %9s\n", "n", "ns/op", "exponent");
+
+    double first = 0, previous = 0;
+    for (long j = 0, n = base; j < SIZES; j++, n *= 2) {
+        double t = run(n) * 1e9;
+
+        if (j == 0)
+            printf("    %8ld %14.1f %9s\n", n, first = t, "");
+        else
+            printf("    %8ld %14.1f %9.2f\n", n, t, log(t / previous) / log(2));
+
+        previous = t;
+        fflush(stdout);
+    }
+
+    double exponent = log(previous / first) / log(2) / (SIZES-1);
+    printf("    overall exponent %.2f (expected ~ %.0f)%s\n\n", exponent, expected,
+        exponent > expected + 0.4 ? "; POSSIBLE COMPLEXITY REGRESSION" : "");
+}
+
+
+// intern n new integers into a table of (at least) n atoms; time per intern
+static double run_integer_new(long n) {
+    for (long j = 0; j < n; j++)
+        atom_integer_new(fresh_integer());
+
+    double start = now();
+    for (long j = 0; j < n; j++)
+        atom_integer_new(fresh_integer());
+    return (now() - start) / n;
+}
+
+// look up n already interned names; time per lookup
+static double run_name_new(long n) {
+    char **names = malloc(n * sizeof *names);
+    for (long j = 0; j < n; j++) {
+        names[j] = mm_malloc("microbench", 32);
+        sprintf(names[j], "]microbench%ld", Unique++);
+        atom_name_new(strdup(names[j]));
+    }
+
+    double start = now();
+    for (long j = 0; j < n; j++)
+        atom_name_new(names[j]);
+    double t = (now() - start) / n;
+
+    free(names);
+    return t;
+}
+
+// look up a bind in the outermost of n nested scopes
+static double run_scope_unbind_depth(long n) {
+    Atom *name = fresh_name();
+    Atom *scope = atom_scope_new_empty();
+    atom_scope_push(scope, name, atom_integer_new(0));
+
+    for (long j = 0; j < n; j++) {
+        scope = atom_scope_new_inherits(scope);
+        atom_scope_push(scope, fresh_name(), atom_integer_new(j));
+    }
+
+    long repetitions = 100;
+    double start = now();
+    for (long j = 0; j < repetitions; j++)
+        atom_scope_unbind(scope, name);
+    return (now() - start) / repetitions;
+}
+
+// look up the last of n binds in a single (function call) scope
+static double run_scope_unbind_width(long n) {
+    Atom *scope = atom_scope_new_empty(), *name = NULL;
+
+    for (long j = 0; j < n; j++)
+        atom_scope_push(scope, name = fresh_name(), atom_integer_new(j));
+
+    long repetitions = 100;
+    double start = now();
+    for (long j = 0; j < repetitions; j++)
+        atom_scope_unbind(scope, name);
+    return (now() - start) / repetitions;
+}
+
+// parse a program of n statements; time per statement
+static double run_parse(long n) {
+    const char *statement = "!f^ab:?<ab+a1*$12.b. ";
+    long length = strlen(statement);
+
+    char *source = malloc(n * length + 1);
+    for (long j = 0; j < n; j++)
+        memcpy(source + j * length, statement, length);
+    source[n * length] = '\0';
+
+    double start = now();
+    parse(source);
+    double t = (now() - start) / n;
+
+    free(source);
+    return t;
+}
+
+// append n atoms to a list; time per push
+static double run_atomlist_push(long n) {
+    AtomList *lst = new_boxed_atomlist();
+    Atom *atom = atom_integer_new(0);
+
+    double start = now();
+    for (long j = 0; j < n; j++)
+        atomlist_push(lst, atom);
+    return (now() - start) / n;
+}
+
+static AtomList *make_atomlist(long n) {
+    AtomList *lst = new_boxed_atomlist();
+    Atom *atom = atom_integer_new(0);
+    for (long j = 0; j < n; j++)
+        atomlist_push_front(lst, atom);
+    return lst;
+}
+
+// copy a list of n atoms; time per element
+static double run_atomlist_copy(long n) {
+    AtomList *lst = make_atomlist(n);
+
+    double start = now();
+    AtomList *copy = atomlist_copy(lst);
+    double t = (now() - start) / n;
+
+    atomlist_free(copy);
+    return t;
+}
+
+// measure the length of a list of n atoms; time per element
+static double run_atomlist_len(long n) {
+    AtomList *lst = make_atomlist(n);
+
+    double start = now();
+    atomlist_len(lst);
+    return (now() - start) / n;
+}
+
+// represent a list struct of n cells; time per cell
+static double run_atom_representation(long n) {
+    AtomList *fields = atomlist_new(NULL);
+    atomlist_push(fields, atom_name_new(strdup("f")));
+    atomlist_push(fields, atom_name_new(strdup("r")));
+    Atom *cell = atom_structinitializer_new(atom_name_new(strdup("L")), fields);
+    Atom *end = atom_structinitializer_new(atom_name_new(strdup("E")), atomlist_new(NULL));
+
+    Atom *lst = atom_struct_new(end, NULL);
+    for (long j = 0; j < n; j++) {
+        Atom **slots = mm_malloc("microbench", 2 * sizeof *slots);
+        slots[0] = atom_integer_new(fresh_integer());
+        slots[1] = lst;
+        lst = atom_struct_new(cell, slots);
+    }
+
+    double start = now();
+    atom_representation(lst);
+    return (now() - start) / n;
+}
+
+
+int main(int argc, char **argv) {
+    globalatomtable_init();
+    GlobOpt.WRN = false;
+
+    report("atom_integer_new (intern new integer, table of n atoms)", 0, 1000, run_integer_new);
+    report("atom_name_new (look up interned name, table of n names)", 0, 1000, run_name_new);
+    report("atom_scope_unbind (outermost bind, scope chain of depth n)", 1, 1000, run_scope_unbind_depth);
+    report("atom_scope_unbind (last bind, one scope of width n)", 1, 1000, run_scope_unbind_width);
+    report("parse (per statement, n statements)", 0, 1000, run_parse);
+    report("atomlist_push (append, list of length n)", 1, 1000, run_atomlist_push);
+    report("atomlist_copy (per element, list of length n)", 0, 1000, run_atomlist_copy);
+    report("atomlist_len (per element, list of length n)", 0, 1000, run_atomlist_len);
+    report("atom_representation (per cell, list struct of n cells)", 0, 100, run_atom_representation);
+
+    memorymanagement_free_all();
+    return EXIT_SUCCESS;
+}
@@ -1,12 +1,26 @@
 #include "Opt.h"
 
 
-Opt GlobOpt = (Opt) {
+// the options every new context starts out with
+const Opt OptDefaults = {
     .ERR = true,
     .WRN = true,
     .INF = false,
     .maximum_interpretation_recursion_depth = 2048,
     .string_view = false,
+    .memstats = false,
+    .profile = false,
+    .memprofile = false,
+    .stats = false,
+    .heap_report = false,
+    .trace = false,
+    .optimization_level = 1,
+    .jit = true,
+    .jobs = 0,
+    .maximum_steps = 0,
+    .maximum_bytes = 0,
+    .maximum_seconds = 0,
+    .cache_directory = 0,
 
     .pedantic = false
 };
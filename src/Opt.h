@@ -8,8 +8,22 @@ typedef struct Opt {
     bool ERR, WRN, INF;
     long maximum_interpretation_recursion_depth;
     bool string_view;
+    bool memstats;
+    bool profile;
+    bool memprofile;
+    bool stats;
+    bool heap_report;
+    bool trace;
+    int optimization_level;
+    bool jit;
+    long jobs;
+    long maximum_steps, maximum_bytes;
+    double maximum_seconds;
+    const char *cache_directory;
 
     bool pedantic;
 } Opt;
 
+extern const Opt OptDefaults;
+
 #endif
@@ -16,6 +16,51 @@
         atomlist_push(pargs.codes, atom_string_newfl(argv[j]));\
     }
 #define ARG_STR pargs.string_view = true;
+#define ARG_PROFILE {\
+        if (++j >= argc)\
+            ERR("Profile flag without file name.\n");\
+        pargs.profile = argv[j];\
+    }
+
+#define ARG_TRACE {\
+        if (++j >= argc)\
+            ERR("Trace flag without file name.\n");\
+        pargs.trace = argv[j];\
+    }
+#define ARG_TRACE_SAMPLE {\
+        if (++j >= argc || (pargs.trace_sample = atol(argv[j])) <= 0)\
+            ERR("Trace sample flag without positive rate.\n");\
+    }
+
+#define ARG_JOBS {\
+        if (++j >= argc || (pargs.jobs = atol(argv[j])) <= 0)\
+            ERR("Jobs flag without positive number of jobs.\n");\
+    }
+
+#define ARG_MAX_STEPS {\
+        if (++j >= argc || (pargs.maximum_steps = atol(argv[j])) <= 0)\
+            ERR("Step budget flag without positive number of steps.\n");\
+    }
+#define ARG_MAX_BYTES {\
+        if (++j >= argc || (pargs.maximum_bytes = atol(argv[j])) <= 0)\
+            ERR("Allocation budget flag without positive number of bytes.\n");\
+    }
+#define ARG_MAX_TIME {\
+        if (++j >= argc || (pargs.maximum_seconds = atof(argv[j])) <= 0)\
+            ERR("Time budget flag without positive number of seconds.\n");\
+    }
+
+#define ARG_EMIT_C {\
+        if (++j >= argc)\
+            ERR("Emit flag without file name.\n");\
+        pargs.emit_c = argv[j];\
+    }
+
+#define ARG_CACHE {\
+        if (++j >= argc)\
+            ERR("Cache flag without directory.\n");\
+        pargs.cache = argv[j];\
+    }
 
 #define ERR(...) return error("ArgParse :: " __VA_ARGS__), pargs
 PArgs parse_args(int argc, char **argv) {
@@ -31,7 +76,22 @@ PArgs parse_args(int argc, char **argv) {
         .wrn = 0,
         .inf = 0,
 
-        .string_view = false
+        .string_view = false,
+        .memstats = false,
+        .profile = NULL,
+        .memprofile = false,
+        .stats = false,
+        .heap_report = false,
+        .trace = NULL,
+        .trace_sample = 1,
+        .optimization_level = 1,
+        .jit = true,
+        .jobs = 0,
+        .maximum_steps = 0,
+        .maximum_bytes = 0,
+        .maximum_seconds = 0,
+        .emit_c = NULL,
+        .cache = NULL
     };
 
     bool interpret_arguments = true;
@@ -52,6 +112,23 @@ PArgs parse_args(int argc, char **argv) {
                 else if (strcmp(arg, "--test") == 0) { ARG_TEST }
                 else if (strcmp(arg, "--code") == 0) { ARG_CODE }
                 else if (strcmp(arg, "--str" ) == 0) { ARG_STR }
+                else if (strcmp(arg, "--memstats") == 0) pargs.memstats = true;
+                else if (strcmp(arg, "--profile" ) == 0) { ARG_PROFILE }
+                else if (strcmp(arg, "--memprofile") == 0) pargs.memprofile = true;
+                else if (strcmp(arg, "--stats"   ) == 0) pargs.stats = true;
+                else if (strcmp(arg, "--heap-report") == 0) pargs.heap_report = true;
+                else if (strcmp(arg, "--trace"   ) == 0) { ARG_TRACE }
+                else if (strcmp(arg, "--trace-sample") == 0) { ARG_TRACE_SAMPLE }
+                else if (strcmp(arg, "--O0"      ) == 0) pargs.optimization_level = 0;
+                else if (strcmp(arg, "--O1"      ) == 0) pargs.optimization_level = 1;
+                else if (strcmp(arg, "--jit"     ) == 0) pargs.jit = true;
+                else if (strcmp(arg, "--nojit"   ) == 0) pargs.jit = false;
+                else if (strcmp(arg, "--jobs"    ) == 0) { ARG_JOBS }
+                else if (strcmp(arg, "--max-steps") == 0) { ARG_MAX_STEPS }
+                else if (strcmp(arg, "--max-bytes") == 0) { ARG_MAX_BYTES }
+                else if (strcmp(arg, "--max-time" ) == 0) { ARG_MAX_TIME }
+                else if (strcmp(arg, "--emit-c"  ) == 0) { ARG_EMIT_C }
+                else if (strcmp(arg, "--cache"   ) == 0) { ARG_CACHE }
 
                 else if (strcmp(arg, "--error"    ) == 0) pargs.err = 1;
                 else if (strcmp(arg, "--warning"  ) == 0) pargs.wrn = 1;
@@ -87,3 +164,12 @@ PArgs parse_args(int argc, char **argv) {
 #undef ARG_TEST
 #undef ARG_CODE
 #undef ARG_STR
+#undef ARG_PROFILE
+#undef ARG_TRACE
+#undef ARG_TRACE_SAMPLE
+#undef ARG_JOBS
+#undef ARG_MAX_STEPS
+#undef ARG_MAX_BYTES
+#undef ARG_MAX_TIME
+#undef ARG_EMIT_C
+#undef ARG_CACHE
@@ -14,6 +14,20 @@ struct PArgs {
 
     int err, wrn, inf;
     bool string_view;
+    bool memstats;
+    const char *profile;
+    bool memprofile;
+    bool stats;
+    bool heap_report;
+    const char *trace;
+    long trace_sample;
+    int optimization_level;
+    bool jit;
+    long jobs;
+    long maximum_steps, maximum_bytes;
+    double maximum_seconds;
+    const char *emit_c;
+    const char *cache;
 };
 typedef struct PArgs PArgs;
 
@@ -7,10 +7,11 @@
 #include "atomlist.h"
 #include "debug.h"
 #include "util.h"
+#include "parse.h"
 #include "memorymanagement.h"
+#include "stats.h"
 
-#include "Opt.h"
-extern Opt GlobOpt;
+#include "context.h"
 
 
 /* GlobalAtomTable
@@ -20,22 +21,160 @@ extern Opt GlobOpt;
     mutable atoms cannot be anti-aliased) and eventual leakless freeing of all atoms.
 */
 
-AtomList *GlobalAtomTable;
-AtomList *GlobalAtomTableMutable;
-Atom *GlobalNullAtom, *GlobalNullConditionAtom, *GlobalNullScopeAtom, *GlobalENullAtom;
-Atom *ImportedSource;
+// GlobalAtomTable, GlobalAtomTableMutable and ImportedSource are the context's (see context.h)
+#define GlobalNullAtom (GlobContext->null_atom)
+#define GlobalNullConditionAtom (GlobContext->nullcondition_atom)
+#define GlobalNullScopeAtom (GlobContext->nullscope_atom)
+#define GlobalENullAtom (GlobContext->Enull_atom)
+
+/* GlobalAtomIndex
+
+    Every anti-aliased atom is additionally filed under its hash, such that
+    anti-aliasing merely probes a single bucket instead of the whole table.
+    Composite atoms (struct initializers, structs and frozen scopes) hash the
+    identities of their -- themselves anti-aliased -- children; their hash is
+    computed once on construction and kept alongside them.
+*/
+
+#define GlobalAtomIndex (GlobContext->atom_index)
+#define GlobalAtomIndexSize (GlobContext->atom_index_size)
+#define GlobalAtomIndexCount (GlobContext->atom_index_count)
+
+static void globalatomindex_init(long size) {
+    GlobalAtomIndex = mm_malloc("globalatomindex_init", size * sizeof *GlobalAtomIndex);
+    GlobalAtomIndexSize = size;
+    GlobalAtomIndexCount = 0;
+
+    for (long j = 0; j < size; j++)
+        GlobalAtomIndex[j].head = NULL;
+}
 
 void globalatomtable_init() {
+    globalatomindex_init(1024);
+
     GlobalAtomTable = atomlist_new(NULL);
     GlobalAtomTableMutable = atomlist_new(NULL);
 
     GlobalNullAtom = GlobalNullConditionAtom = GlobalNullScopeAtom = NULL;
     ImportedSource = atom_scope_new_empty();
+    atom_scope_index(ImportedSource);
 
     #include "../stdlib/krrp_stdlib.c_fragment"
 }
 
 
+static unsigned long hash_mix(unsigned long hash, unsigned long value) {
+    hash = (hash ^ value) * 1099511628211UL;
+    return hash ^ (hash >> 29);
+}
+
+static unsigned long hash_string(const char *str) {
+    unsigned long hash = 14695981039346656037UL;
+    for (; *str; str++)
+        hash = (hash ^ (unsigned char) *str) * 1099511628211UL;
+
+    return hash;
+}
+
+static unsigned long hash_atoms(unsigned long hash, AtomList *lst) {
+    for (AtomListNode *node = lst->head; node; node = node->next)
+        hash = hash_mix(hash, (unsigned long) node->atom);
+
+    return hash;
+}
+
+static unsigned long atom_hash(Atom *atom) {
+    switch (atom->type) {
+        case atom_type_name:
+            return hash_mix(atom->type, hash_string(((NameAtom *) atom->atom)->name));
+        case atom_type_integer:
+            return hash_mix(atom->type, ((IntegerAtom *) atom->atom)->value);
+        case atom_type_primitive:
+            return hash_mix(atom->type, ((PrimitiveAtom *) atom->atom)->c);
+        case atom_type_string:
+            return hash_mix(atom->type, hash_string(((StringAtom *) atom->atom)->str));
+
+        case atom_type_structinitializer:
+            return ((StructInitializerAtom *) atom->atom)->hash;
+        case atom_type_struct:
+            return ((StructAtom *) atom->atom)->hash;
+        case atom_type_scope:
+            return ((ScopeAtom *) atom->atom)->hash;
+
+        default:
+            return 0;
+    }
+}
+
+static void globalatomindex_insert(Atom *atom) {
+    // keep the load factor at most one
+    if (GlobalAtomIndexCount >= GlobalAtomIndexSize) {
+        AtomList *index = GlobalAtomIndex;
+        long size = GlobalAtomIndexSize, count = GlobalAtomIndexCount;
+        globalatomindex_init(2 * size);
+
+        for (long j = 0; j < size; j++) {
+            AtomListNode *node = index[j].head;
+            while (node) {
+                AtomListNode *next = node->next;
+                AtomList *bucket = &GlobalAtomIndex[atom_hash(node->atom) & (GlobalAtomIndexSize-1)];
+                node->next = bucket->head;
+                bucket->head = node;
+                node = next;
+            }
+        }
+
+        mm_free("globalatomindex_insert", index);
+        GlobalAtomIndexCount = count;
+    }
+
+    atomlist_push_front(&GlobalAtomIndex[atom_hash(atom) & (GlobalAtomIndexSize-1)], atom);
+    GlobalAtomIndexCount++;
+}
+
+// drop an atom about to be freed from the index, if it is filed there
+void globalatomindex_remove(Atom *atom) {
+    switch (atom->type) {
+        case atom_type_name:
+        case atom_type_integer:
+        case atom_type_primitive:
+        case atom_type_structinitializer:
+        case atom_type_struct:
+        case atom_type_string:
+            break;
+
+        case atom_type_scope:
+            if (((ScopeAtom *) atom->atom)->is_frozen)
+                break;
+            return;
+
+        default:
+            return;
+    }
+
+    atomlist_remove_by_pointer(&GlobalAtomIndex[atom_hash(atom) & (GlobalAtomIndexSize-1)], atom);
+    GlobalAtomIndexCount--;
+}
+
+/* Does not free any atoms. */
+void globalatomindex_free() {
+    if (!GlobalAtomIndex)
+        return;
+
+    for (long j = 0; j < GlobalAtomIndexSize; j++) {
+        AtomListNode *node = GlobalAtomIndex[j].head;
+        while (node) {
+            AtomListNode *next = node->next;
+            atomlistnode_free(node);
+            node = next;
+        }
+    }
+
+    mm_free("globalatomindex_free", GlobalAtomIndex);
+    GlobalAtomIndex = NULL;
+}
+
+
 static Atom *_atom_new(atom_type type, void *atom) {
     Atom *natom = mm_malloc("_atom_new", sizeof *natom);
 
@@ -49,12 +188,24 @@ Atom *atom_new(atom_type type, void *atom) {
     Atom *natom = _atom_new(type, atom);
 
     if (natom->type == atom_type_scope
+    || natom->type == atom_type_thunk
+    || natom->type == atom_type_shared
+    || natom->type == atom_type_inline
+    || natom->type == atom_type_unboxed
     || natom->type == atom_type_function
     || natom->type == atom_type_list)
         atomlist_push_front(GlobalAtomTableMutable, natom);
     else
         atomlist_push_front(GlobalAtomTable, natom);
 
+    if (natom->type == atom_type_name
+    || natom->type == atom_type_integer
+    || natom->type == atom_type_primitive
+    || natom->type == atom_type_structinitializer
+    || natom->type == atom_type_struct
+    || natom->type == atom_type_string)
+        globalatomindex_insert(natom);
+
     return natom;
 }
 
@@ -88,19 +239,15 @@ const char *atom_repr(Atom *atom) {
     return string_atom->str;
 }
 
-static Atom *atom_struct_representation(Atom *scope) {
+static Atom *atom_struct_representation(Atom *atom) {
     Atom *repr = atom_string_newfl("");
-    ScopeAtom *scope_atom = scope->atom;
-    AtomListNode *noden = scope_atom->names->head;
-    AtomListNode *nodeb = scope_atom->binds->head;
-    while (noden && nodeb) {
+    StructAtom *struct_atom = atom->atom;
+    StructInitializerAtom *shape = struct_atom->shape->atom;
+    for (int j = 0; j < shape->size; j++)
         repr = atom_string_concat(
             repr,
-            atom_representation(nodeb->atom)
+            atom_representation(struct_atom->slots[j])
         );
-        noden = noden->next;
-        nodeb = nodeb->next;
-    }
     return repr;
 }
 
@@ -154,6 +301,7 @@ Atom *atom_representation(Atom *atom) {
 
     else if (atom->type == atom_type_functiondeclaration) {
         FunctionDeclarationAtom *functiondeclaration_atom = atom->atom;
+        parse_body(functiondeclaration_atom);
         return atom_string_concat7(
             atom_string_newfl("FunctionDeclaration(arity: "),
             atom_string_fromlong(functiondeclaration_atom->arity),
@@ -167,7 +315,9 @@ Atom *atom_representation(Atom *atom) {
 
     else if (atom->type == atom_type_function) {
         FunctionAtom *function_atom = atom->atom;
-        if (function_atom->primitive == NULL)
+        if (function_atom->declaration)
+            parse_body(function_atom->declaration);
+        if (function_atom->primitive == primitive_none)
             return atom_string_concat9(
                 atom_string_newfl("Function(arity: "),
                 atom_string_fromlong(function_atom->arity),
@@ -184,7 +334,7 @@ Atom *atom_representation(Atom *atom) {
                 atom_string_newfl("PrimitiveFunction(arity: "),
                 atom_string_fromlong(function_atom->arity),
                 atom_string_newfl(", primitive: "),
-                atom_string_newcopy(function_atom->primitive),
+                atom_string_newfl(primitive_symbol(function_atom->primitive)),
                 atom_string_newfl(")")
             );
     }
@@ -216,6 +366,26 @@ Atom *atom_representation(Atom *atom) {
         );
     }
 
+    else if (atom->type == atom_type_thunk)
+        return atom_representation(atom_thunk_force(atom));
+
+    else if (atom->type == atom_type_shared)
+        return atom_string_concat3(
+            atom_string_newfl("Shared("),
+            atom_string_fromlong(((SharedAtom *) atom->atom)->slot),
+            atom_string_newfl(")")
+        );
+
+    else if (atom->type == atom_type_inline)
+        return atom_string_concat3(
+            atom_string_newfl("Inline("),
+            atomlist_representation(((InlineAtom *) atom->atom)->expansion),
+            atom_string_newfl(")")
+        );
+
+    else if (atom->type == atom_type_unboxed)
+        return atom_string_newfl("Unboxed");
+
     else if (atom->type == atom_type_structinitializer) {
         StructInitializerAtom *structinitializer_atom = atom->atom;
         return atom_string_concat5(
@@ -228,14 +398,12 @@ Atom *atom_representation(Atom *atom) {
     }
 
     else if (atom->type == atom_type_struct) {
-        StructAtom *struct_atom = atom->atom;
-
         if (GlobOpt.string_view)
-            return atom_struct_representation(struct_atom->scope);
+            return atom_struct_representation(atom);
         else
             return atom_string_concat(
-                atom_representation(struct_atom->type),
-                atom_struct_representation(struct_atom->scope)
+                atom_representation(atom_struct_type(atom)),
+                atom_struct_representation(atom)
             );
     }
 
@@ -251,11 +419,14 @@ Atom *atom_representation(Atom *atom) {
 }
 
 
-// start_GlobalAtomTable_antialiasing ... end_GlobalAtomTable_antialiasing
-#define start_GlobalAtomTable_antialiasing { \
-    AtomListNode *node = GlobalAtomTable->head; \
-    while (node) { Atom *atom = node->atom;
-#define end_GlobalAtomTable_antialiasing node = node->next; } }
+// start_GlobalAtomTable_antialiasing(type, hash) ... end_GlobalAtomTable_antialiasing
+#define start_GlobalAtomTable_antialiasing(type, hash) { \
+    atom_type antialiasing_type = (type); \
+    STAT(intern_lookups[antialiasing_type]++); \
+    AtomListNode *node = GlobalAtomIndex[(hash) & (GlobalAtomIndexSize-1)].head; \
+    while (node) { Atom *atom = node->atom; STAT(intern_probes[antialiasing_type]++);
+#define end_GlobalAtomTable_antialiasing node = node->next; } \
+    STAT(intern_misses[antialiasing_type]++); }
 
 
 bool atom_is_of_type(Atom *atom, atom_type type) {
@@ -286,8 +457,11 @@ MAKE__ATOM_NULLX(Enull, ENull)
 #undef MAKE__ATOM_NULLX
 
 
+// dense symbol identifiers, handed out in order of interning
+#define GlobalNameCount (GlobContext->name_count)
+
 Atom *atom_name_new(char *name) {
-    start_GlobalAtomTable_antialiasing
+    start_GlobalAtomTable_antialiasing(atom_type_name, hash_mix(atom_type_name, hash_string(name)))
         if (atom_name_is(atom)) {
             NameAtom *name_atom = atom->atom;
             if (strcmp(name_atom->name, name) == 0) {
@@ -300,6 +474,7 @@ Atom *atom_name_new(char *name) {
 
     NameAtom *name_atom = mm_malloc("atom_name_new", sizeof *name_atom);
     name_atom->name = name;
+    name_atom->id = GlobalNameCount++;
 
     return atom_new(atom_type_name, name_atom);
 }
@@ -310,7 +485,7 @@ bool atom_name_is(Atom *atom) {
 
 
 Atom *atom_integer_new(integer value) {
-    start_GlobalAtomTable_antialiasing
+    start_GlobalAtomTable_antialiasing(atom_type_integer, hash_mix(atom_type_integer, value))
         if (atom_integer_is(atom)) {
             IntegerAtom *integer_atom = atom->atom;
             if (integer_atom->value == value)
@@ -332,7 +507,7 @@ bool atom_integer_is(Atom *atom) {
 
 
 Atom *atom_primitive_new(char c) {
-    start_GlobalAtomTable_antialiasing
+    start_GlobalAtomTable_antialiasing(atom_type_primitive, hash_mix(atom_type_primitive, c))
         if (atom_primitive_is(atom)) {
             PrimitiveAtom *primitive_atom = atom->atom;
             if (primitive_atom->c == c)
@@ -353,17 +528,44 @@ bool atom_primitive_is(Atom *atom) {
 }
 
 
-Atom *atom_functiondeclaration_new(int arity, AtomList *parameters, AtomList *body) {
+// whether calls can bind their parameters in a frame; duplicate parameters
+// fail to bind, which is left to be reported by ordinary calls
+static bool atom_functiondeclaration_inline_frame(AtomList *parameters, bool binds) {
+    if (binds)
+        return false;
+
+    for (AtomListNode *node = parameters->head; node; node = node->next)
+        for (AtomListNode *other = node->next; other; other = other->next)
+            if (atom_equal(node->atom, other->atom))
+                return false;
+
+    return true;
+}
+
+/* `source` is the body up to and including its `.`; `binds` tells whether
+   it binds, imports or declares a function at its top level, `imports`
+   whether it imports anywhere. */
+Atom *atom_functiondeclaration_new(int arity, AtomList *parameters, char *source, bool binds, bool imports) {
     if (!atomlist_is(parameters)
     || !atomlist_purely(parameters, atom_type_name)
-    || !atomlist_is(body))
+    || !source)
         return error_atom("atom_functiondeclaration_new: Invalid arguments.\n"), NULL;
 
     FunctionDeclarationAtom *functiondeclaration_atom
         = mm_malloc("atom_functiondeclaration_new", sizeof *functiondeclaration_atom);
     functiondeclaration_atom->arity = arity;
     functiondeclaration_atom->parameters = parameters;
-    functiondeclaration_atom->body = body;
+    functiondeclaration_atom->body = atomlist_new(NULL);
+
+    functiondeclaration_atom->inline_frame = atom_functiondeclaration_inline_frame(parameters, binds);
+    functiondeclaration_atom->kernel = NULL;
+
+    functiondeclaration_atom->source = source;
+    functiondeclaration_atom->lazy = true;
+    functiondeclaration_atom->imports = imports;
+    functiondeclaration_atom->enclosing = NULL;
+    functiondeclaration_atom->substitutions = NULL;
+    functiondeclaration_atom->shared = -1;
 
     return atom_new(atom_type_functiondeclaration, functiondeclaration_atom);
 }
@@ -372,14 +574,14 @@ bool atom_functiondeclaration_is(Atom *atom) {
     return atom_is_of_type(atom, atom_type_functiondeclaration);
 }
 
-Atom *atom_function_new(int arity, AtomList *parameters, AtomList *body, Atom *scope, char *primitive) {
+Atom *atom_function_new(int arity, AtomList *parameters, AtomList *body, Atom *scope, primitive_opcode primitive) {
     if (!atom_scope_is(scope) && !atom_nullscope_is(scope))
         return error_atom("atom_function_new: Given invalid scope ScopeAtom.\n"), NULL;
 
-    if (primitive && (parameters != NULL || body != NULL))
+    if (primitive != primitive_none && (parameters != NULL || body != NULL))
             return error_atom("atom_function_new: Invalid primitive initialization.\n"), NULL;
 
-    if (!primitive && (!atomlist_is(parameters) || !atomlist_is(body)))
+    if (primitive == primitive_none && (!atomlist_is(parameters) || !atomlist_is(body)))
         return error_atom("atom_function_new: Given invalid parameters AtomList and/or body AtomList and/or scope ScopeAtom.\n"), NULL;
 
     FunctionAtom *function_atom = mm_malloc("atom_function_new", sizeof *function_atom);
@@ -388,6 +590,7 @@ Atom *atom_function_new(int arity, AtomList *parameters, AtomList *body, Atom *s
     function_atom->body = body;
     function_atom->scope = scope;
     function_atom->primitive = primitive;
+    function_atom->declaration = NULL;
 
     return atom_new(atom_type_function, function_atom);
 }
@@ -399,6 +602,44 @@ bool atom_function_is(Atom *atom) {
     return true;
 }
 
+// a closure of `declaration` over `scope`, as interpreting the declaration creates
+Atom *atom_closure_new(Atom *declaration, Atom *scope) {
+    FunctionDeclarationAtom *fd = declaration->atom;
+    Atom *scp = atom_scope_new_inherits(scope);
+    Atom *f_scp = atom_scope_new_inherits(scp);
+    // parameters and body are shared with the declaration
+    Atom *f = atom_function_new(
+        fd->arity,
+        fd->parameters,
+        fd->body,
+        f_scp,
+        primitive_none
+    );
+    ((FunctionAtom *) f->atom)->declaration = fd;
+
+    // self-referring name
+    atom_scope_push(scp, atom_name_new(strdup("@")), f);
+    atom_scope_setflag_isselfref(scp, true);
+
+    return f;
+}
+
+const char *primitive_symbol(primitive_opcode primitive) {
+    static const char *symbols[] = {
+        [primitive_none] = "",
+
+        [primitive_modulo] = "%", [primitive_multiply] = "*",
+        [primitive_add] = "+", [primitive_subtract] = "-",
+        [primitive_divide] = "/", [primitive_less] = "<",
+        [primitive_equal] = "=", [primitive_greater] = ">",
+
+        [primitive_pmap] = "[pmap]", [primitive_pfilter] = "[pfilter]",
+        [primitive_preduce] = "[preduce]"
+    };
+
+    return symbols[primitive];
+}
+
 Atom *atom_scope_new(AtomList *names, AtomList *binds, Atom *upper_scope) {
     /* Scope atoms are mutable and therefor shall not be anti-aliased. */
 
@@ -417,10 +658,90 @@ Atom *atom_scope_new(AtomList *names, AtomList *binds, Atom *upper_scope) {
     scope_atom->is_main = false;
     scope_atom->is_selfref = false;
     scope_atom->is_frozen = false;
+    scope_atom->is_frame = false;
+    scope_atom->is_import = false;
+    scope_atom->hash = 0;
+    scope_atom->table = NULL;
+    scope_atom->table_size = 0;
+    scope_atom->shared = NULL;
 
     return atom_new(atom_type_scope, scope_atom);
 }
 
+static void atom_scope_table_set(ScopeAtom *scope_atom, Atom *name, Atom *bind) {
+    long id = ((NameAtom *) name->atom)->id;
+
+    if (id >= scope_atom->table_size) {
+        long size = 2 * scope_atom->table_size;
+        if (size <= id)
+            size = id + 1;
+
+        Atom **table = mm_malloc("atom_scope_table_set", size * sizeof *table);
+        for (long j = 0; j < size; j++)
+            table[j] = j < scope_atom->table_size ? scope_atom->table[j] : NULL;
+
+        mm_free("atom_scope_table_set", scope_atom->table);
+        scope_atom->table = table;
+        scope_atom->table_size = size;
+    }
+
+    scope_atom->table[id] = bind;
+}
+
+/* Top-level scopes (main, import and program scopes) accumulate many binds
+   and are consulted by almost every name lookup; indexing such a scope
+   additionally files its binds under their names' symbol identifiers. */
+void atom_scope_index(Atom *scope) {
+    if (!atom_scope_is(scope))
+        { error_atom("atom_scope_index: Expected ScopeAtom.\n"); return; }
+
+    ScopeAtom *scope_atom = scope->atom;
+    if (scope_atom->table)
+        return;
+
+    scope_atom->table_size = 16;
+    scope_atom->table = mm_malloc("atom_scope_index", scope_atom->table_size * sizeof *scope_atom->table);
+    for (long j = 0; j < scope_atom->table_size; j++)
+        scope_atom->table[j] = NULL;
+
+    AtomListNode *names_node = scope_atom->names->head;
+    AtomListNode *binds_node = scope_atom->binds->head;
+    while (names_node && binds_node) {
+        atom_scope_table_set(scope_atom, names_node->atom, binds_node->atom);
+
+        names_node = names_node->next;
+        binds_node = binds_node->next;
+    }
+}
+
+// drop all but the scope's first `size` binds
+void atom_scope_truncate(Atom *scope, long size) {
+    if (!atom_scope_is(scope))
+        { error_atom("atom_scope_truncate: Expected ScopeAtom.\n"); return; }
+
+    ScopeAtom *scope_atom = scope->atom;
+    AtomListNode **names_node = &scope_atom->names->head;
+    AtomListNode **binds_node = &scope_atom->binds->head;
+    for (long j = 0; j < size && *names_node && *binds_node; j++) {
+        names_node = &(*names_node)->next;
+        binds_node = &(*binds_node)->next;
+    }
+
+    while (*names_node) {
+        AtomListNode *next = (*names_node)->next;
+        if (scope_atom->table)
+            scope_atom->table[((NameAtom *) (*names_node)->atom->atom)->id] = NULL;
+        atomlistnode_free(*names_node);
+        *names_node = next;
+    }
+
+    while (*binds_node) {
+        AtomListNode *next = (*binds_node)->next;
+        atomlistnode_free(*binds_node);
+        *binds_node = next;
+    }
+}
+
 Atom *atom_scope_freeze(Atom *scope) {
     if (!atom_scope_is(scope))
         return error_atom("atom_scope_freeze: Expected ScopeAtom, got %s.\n", atom_repr(scope)), NULL;
@@ -432,7 +753,11 @@ Atom *atom_scope_freeze(Atom *scope) {
 
     atomlist_remove_by_pointer(GlobalAtomTableMutable, scope);
 
-    start_GlobalAtomTable_antialiasing
+    original_scope_atom->hash = hash_mix(hash_atoms(hash_atoms(atom_type_scope,
+        original_scope_atom->names), original_scope_atom->binds),
+        (unsigned long) original_scope_atom->upper_scope);
+
+    start_GlobalAtomTable_antialiasing(atom_type_scope, original_scope_atom->hash)
         if (atom_scope_is(atom)) {
             ScopeAtom *scope_atom = atom->atom;
             if (scope_atom->is_frozen
@@ -445,6 +770,7 @@ Atom *atom_scope_freeze(Atom *scope) {
 
 
     atomlist_push_front(GlobalAtomTable, scope);
+    globalatomindex_insert(scope);
     return scope;
 }
 
@@ -452,8 +778,15 @@ Atom *atom_scope_new_empty() {
     return atom_scope_new(atomlist_new(NULL), atomlist_new(NULL), atom_nullscope_new());
 }
 
+// a program's (or import's) scope above its main scope; both are indexed
 Atom *atom_scope_new_double_empty() {
-    return atom_scope_new(atomlist_new(NULL), atomlist_new(NULL), atom_scope_new_empty());
+    Atom *main_scope = atom_scope_new_empty();
+    atom_scope_index(main_scope);
+
+    Atom *scope = atom_scope_new(atomlist_new(NULL), atomlist_new(NULL), main_scope);
+    atom_scope_index(scope);
+
+    return scope;
 }
 
 bool atom_scope_is(Atom *atom) {
@@ -531,6 +864,18 @@ bool atom_scope_push(Atom *scope, Atom *name, Atom *bind) {
     if (scope_atom->is_frozen)
         return error_atom("atom_scope_push: Scope is frozen."), false;
 
+    if (scope_atom->table) {
+        Atom *bound = atom_scope_lookup_local(scope, name);
+        if (bound)
+            return error_atom("atom_scope_push: Attempt at name rebinding (%s already bound as %s).\n", atom_repr(name), atom_repr(bound)), false;
+
+        atomlist_push(scope_atom->names, name);
+        atomlist_push(scope_atom->binds, bind);
+        atom_scope_table_set(scope_atom, name, bind);
+
+        return true;
+    }
+
     AtomListNode *names_node = scope_atom->names->head;
     AtomListNode *binds_node = scope_atom->binds->head;
     while (names_node && binds_node) {
@@ -550,17 +895,18 @@ bool atom_scope_push(Atom *scope, Atom *name, Atom *bind) {
     return true;
 }
 
-Atom *atom_scope_unbind(Atom *scope, Atom *name) {
-    if (!atom_scope_is(scope) || !atom_name_is(name))
-        return error_atom("atom_scope_unbind: Given invalid scope ScopeAtom and/or name NameAtom.\n"), NULL;
-
+// bind of `name` within `scope` itself, NULL if there is none
+Atom *atom_scope_lookup_local(Atom *scope, Atom *name) {
     ScopeAtom *scope_atom = scope->atom;
+
+    if (scope_atom->table) {
+        long id = ((NameAtom *) name->atom)->id;
+        return id < scope_atom->table_size ? scope_atom->table[id] : NULL;
+    }
+
     AtomListNode *names_node = scope_atom->names->head;
     AtomListNode *binds_node = scope_atom->binds->head;
     while (names_node && binds_node) {
-        if (!atom_name_is(names_node->atom))
-            return error_atom("atom_scope_unbind: Detected invalidity of ScopeAtom's names.\n"), NULL;
-
         if (atom_equal(names_node->atom, name))
             return binds_node->atom;
 
@@ -568,34 +914,125 @@ Atom *atom_scope_unbind(Atom *scope, Atom *name) {
         binds_node = binds_node->next;
     }
 
-    if (atom_nullscope_is(scope_atom->upper_scope))
+    return NULL;
+}
+
+// bind of `name` within `scope` or its upper scopes, NULL if there is none
+Atom *atom_scope_lookup(Atom *scope, Atom *name) {
+    STAT(scope_lookups++);
+
+    while (atom_scope_is(scope)) {
+        STAT(scope_links++);
+        Atom *bind = atom_scope_lookup_local(scope, name);
+        if (bind)
+            return bind->type == atom_type_thunk ? atom_thunk_force(bind) : bind;
+
+        scope = ((ScopeAtom *) scope->atom)->upper_scope;
+    }
+
+    return NULL;
+}
+
+Atom *atom_scope_unbind(Atom *scope, Atom *name) {
+    if (!atom_scope_is(scope) || !atom_name_is(name))
+        return error_atom("atom_scope_unbind: Given invalid scope ScopeAtom and/or name NameAtom.\n"), NULL;
+
+    Atom *bind = atom_scope_lookup(scope, name);
+    if (!bind)
         return error_atom("atom_scope_unbind: Could not find name bind (%s).\n", atom_repr(name)), NULL;
 
-    /* Perfect use of tail recursion! */
-    return atom_scope_unbind(scope_atom->upper_scope, name);
+    return bind;
 }
 
 bool atom_scope_contains_bind(Atom *scope, Atom *name) {
     if (!atom_scope_is(scope) || !atom_name_is(name))
         return error_atom("atom_scope_contains_bind: Expected scope and name.\n"), false;
 
-    ScopeAtom *scope_atom = scope->atom;
-    AtomListNode *names_node = scope_atom->names->head;
-    while (names_node) {
-        if (atom_equal(names_node->atom, name))
-            return true;
+    return !!atom_scope_lookup_local(scope, name);
+}
 
-        names_node = names_node->next;
+// nothing binds within a frame, so it need not be shielded from inactive binds
+Atom *atom_scope_new_fake(Atom *scope) {
+    if (atom_scope_is(scope) && ((ScopeAtom *) scope->atom)->is_frame)
+        return scope;
+
+    return atom_scope_new(atomlist_new(NULL), atomlist_new(NULL), scope);
+}
+Atom *atom_scope_new_inherits(Atom *scope) { return atom_scope_new(atomlist_new(NULL), atomlist_new(NULL), scope); }
+
+Atom *atom_thunk_new(Atom *declaration, Atom *scope) {
+    if (!atom_functiondeclaration_is(declaration) || !atom_scope_is(scope))
+        return error_atom("atom_thunk_new: Given invalid declaration FunctionDeclarationAtom and/or scope ScopeAtom.\n"), NULL;
+
+    ThunkAtom *thunk_atom = mm_malloc("atom_thunk_new", sizeof *thunk_atom);
+    thunk_atom->declaration = declaration;
+    thunk_atom->scope = scope;
+    thunk_atom->value = NULL;
+
+    return atom_new(atom_type_thunk, thunk_atom);
+}
+
+bool atom_thunk_is(Atom *atom) {
+    return atom_is_of_type(atom, atom_type_thunk);
+}
+
+Atom *atom_thunk_force(Atom *atom) {
+    ThunkAtom *thunk_atom = atom->atom;
+    if (!thunk_atom->value) {
+        thunk_atom->value = atom_closure_new(thunk_atom->declaration, thunk_atom->scope);
+        mm_checkpoint_forced(thunk_atom);
     }
 
-    return false;
+    return thunk_atom->value;
 }
 
-Atom *atom_scope_new_fake(Atom *scope) { return atom_scope_new(atomlist_new(NULL), atomlist_new(NULL), scope); }
-Atom *atom_scope_new_inherits(Atom *scope) { return atom_scope_new(atomlist_new(NULL), atomlist_new(NULL), scope); }
+Atom *atom_shared_new(int slot, AtomListNode *end) {
+    SharedAtom *shared_atom = mm_malloc("atom_shared_new", sizeof *shared_atom);
+    shared_atom->slot = slot;
+    shared_atom->end = end;
+
+    return atom_new(atom_type_shared, shared_atom);
+}
+
+bool atom_shared_is(Atom *atom) {
+    return atom_is_of_type(atom, atom_type_shared);
+}
+
+Atom *atom_inline_new(AtomList *expansion, InlineGuard *guards, int guards_size, AtomListNode *end) {
+    InlineAtom *inline_atom = mm_malloc("atom_inline_new", sizeof *inline_atom);
+    inline_atom->expansion = expansion;
+    inline_atom->guards = mm_malloc("atom_inline_new: guards", guards_size * sizeof *guards);
+    for (int j = 0; j < guards_size; j++)
+        inline_atom->guards[j] = guards[j];
+    inline_atom->guards_size = guards_size;
+    inline_atom->end = end;
+
+    return atom_new(atom_type_inline, inline_atom);
+}
+
+bool atom_inline_is(Atom *atom) {
+    return atom_is_of_type(atom, atom_type_inline);
+}
+
+Atom *atom_unboxed_new(Kernel *kernel, AtomListNode *end) {
+    UnboxedAtom *unboxed_atom = mm_malloc("atom_unboxed_new", sizeof *unboxed_atom);
+    unboxed_atom->kernel = kernel;
+    unboxed_atom->end = end;
+
+    return atom_new(atom_type_unboxed, unboxed_atom);
+}
+
+bool atom_unboxed_is(Atom *atom) {
+    return atom_is_of_type(atom, atom_type_unboxed);
+}
 
 Atom *atom_structinitializer_new(Atom *type, AtomList *fields) {
-    start_GlobalAtomTable_antialiasing
+    if (!atom_is(type) || !fields)
+        return error_atom("atom_structinitializer_new: Given invalid struct type or fields AtomList.\n"), NULL;
+
+    unsigned long hash = hash_atoms(hash_mix(atom_type_structinitializer, (unsigned long) type), fields);
+
+    start_GlobalAtomTable_antialiasing(atom_type_structinitializer, hash)
         if (atom_structinitializer_is(atom)) {
             StructInitializerAtom *structinitializer_atom = atom->atom;
             if (atom_equal(structinitializer_atom->type, type)
@@ -605,9 +1042,6 @@ Atom *atom_structinitializer_new(Atom *type, AtomList *fields) {
     end_GlobalAtomTable_antialiasing
 
 
-    if (!atom_is(type) || !fields)
-        return error_atom("atom_structinitializer_new: Given invalid struct type or fields AtomList.\n"), NULL;
-
     AtomListNode *node = fields->head;
     while (node) {
         if (!atom_name_is(node->atom))
@@ -619,6 +1053,24 @@ Atom *atom_structinitializer_new(Atom *type, AtomList *fields) {
     StructInitializerAtom *structinitializer_atom = mm_malloc("atom_structinitializer_new", sizeof *structinitializer_atom);
     structinitializer_atom->type = type;
     structinitializer_atom->fields = fields;
+    structinitializer_atom->arity = atomlist_len(fields);
+    structinitializer_atom->size = 0;
+    structinitializer_atom->layout = NULL;
+    structinitializer_atom->hash = hash;
+
+    // as fields used to be bound in a scope, a repeated one is a single slot
+    if (structinitializer_atom->arity > 0) {
+        structinitializer_atom->layout = mm_malloc("atom_structinitializer_new: layout",
+            structinitializer_atom->arity * sizeof *structinitializer_atom->layout);
+
+        for (AtomListNode *node = fields->head; node; node = node->next) {
+            int j = 0;
+            while (j < structinitializer_atom->size && structinitializer_atom->layout[j] != node->atom)
+                j++;
+            if (j == structinitializer_atom->size)
+                structinitializer_atom->layout[structinitializer_atom->size++] = node->atom;
+        }
+    }
 
     return atom_new(atom_type_structinitializer, structinitializer_atom);
 }
@@ -631,30 +1083,53 @@ bool atom_structinitializer_is(Atom *atom) {
     return !!structinitializer_atom->fields;
 }
 
-Atom *atom_struct_new(Atom *type, Atom *scope) {
-    start_GlobalAtomTable_antialiasing
+/* Slot index of a field within a shape (-1 if there is no such field).
+   Field names are anti-aliased, thus a shape's few slots are told apart by
+   pointer alone. */
+int atom_structinitializer_slot(Atom *atom, Atom *field) {
+    StructInitializerAtom *structinitializer_atom = atom->atom;
+
+    for (int j = 0; j < structinitializer_atom->size; j++)
+        if (structinitializer_atom->layout[j] == field)
+            return j;
+
+    return -1;
+}
+
+/* Takes ownership of `slots`, which has to hold as many atoms as the shape has
+   fields. */
+Atom *atom_struct_new(Atom *shape, Atom **slots) {
+    if (!atom_structinitializer_is(shape))
+        return error_atom("atom_struct_new: Given invalid shape.\n"), NULL;
+
+    int size = ((StructInitializerAtom *) shape->atom)->size;
+
+    unsigned long hash = hash_mix(atom_type_struct, (unsigned long) shape);
+    for (int j = 0; j < size; j++)
+        hash = hash_mix(hash, (unsigned long) slots[j]);
+
+    start_GlobalAtomTable_antialiasing(atom_type_struct, hash)
         if (atom_struct_is(atom)) {
             StructAtom *struct_atom = atom->atom;
-            if (atom_equal(type, struct_atom->type)
-            && atom_equal(scope, struct_atom->scope))
-                return atom;
+            if (atom_equal(shape, struct_atom->shape)) {
+                int j = 0;
+                while (j < size && atom_equal(slots[j], struct_atom->slots[j]))
+                    j++;
+
+                if (j == size) {
+                    if (slots)
+                        mm_free("atom_struct_new", slots);
+                    return atom;
+                }
+            }
         }
     end_GlobalAtomTable_antialiasing
 
 
-    if (!atom_name_is(type))
-        return error_atom("atom_struct_new: Given invalid type.\n"), NULL;
-
-    if (!atom_scope_is(scope))
-        return error_atom("atom_struct_new: Given invalid scope.\n"), NULL;
-
-    if (!(((ScopeAtom *) scope->atom)->is_frozen))
-        return error_atom("atom_struct_new: Thawed scope.\n"), NULL;
-
     StructAtom *struct_atom = mm_malloc("atom_struct_new", sizeof *struct_atom);
-    struct_atom->type = type;
-    struct_atom->scope = scope;
-
+    struct_atom->shape = shape;
+    struct_atom->slots = slots;
+    struct_atom->hash = hash;
 
     return atom_new(atom_type_struct, struct_atom);
 }
@@ -664,11 +1139,24 @@ bool atom_struct_is(Atom *atom) {
         return false;
 
     StructAtom *struct_atom = atom->atom;
-    return atom_is(struct_atom->type) && atom_scope_is(struct_atom->scope);
+    return atom_structinitializer_is(struct_atom->shape);
+}
+
+Atom *atom_struct_type(Atom *atom) {
+    StructAtom *struct_atom = atom->atom;
+    return ((StructInitializerAtom *) struct_atom->shape->atom)->type;
+}
+
+// NULL if the struct has no such field
+Atom *atom_struct_field(Atom *atom, Atom *field) {
+    StructAtom *struct_atom = atom->atom;
+    int slot = atom_structinitializer_slot(struct_atom->shape, field);
+
+    return slot < 0 ? NULL : struct_atom->slots[slot];
 }
 
 Atom *atom_string_new(char *str) {
-    start_GlobalAtomTable_antialiasing
+    start_GlobalAtomTable_antialiasing(atom_type_string, hash_mix(atom_type_string, hash_string(str)))
         if (atom_string_is(atom)) {
             StringAtom *string_atom = atom->atom;
             if (strcmp(string_atom->str, str) == 0)
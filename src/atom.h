@@ -13,6 +13,8 @@
 
 void globalatomtable_init();
 void globalatomtable_print();
+void globalatomindex_free();
+void globalatomindex_remove(Atom *atom);
 
 
 struct Atom { atom_type type; void *atom; };
@@ -39,7 +41,7 @@ struct ENullAtom { EMPTY };
 Atom *atom_Enull_new();
 bool atom_Enull_is(Atom *atom);
 
-struct NameAtom { char *name; };
+struct NameAtom { char *name; long id; };
 Atom *atom_name_new(char *name);
 bool atom_name_is(Atom *atom);
 
@@ -51,15 +53,36 @@ struct PrimitiveAtom { char c; };
 Atom *atom_primitive_new(char c);
 bool atom_primitive_is(Atom *atom);
 
-struct FunctionDeclarationAtom { int arity; AtomList *parameters; AtomList *body; };
-Atom *atom_functiondeclaration_new(int arity, AtomList *parameters, AtomList *body);
+// functions whose bodies neither bind (`!`), import (`\`) nor declare closures
+// (`^`) cannot retain their call scope, which thus lives in a frame on the
+// C stack; see `inline_frame`
+// integer kernels compiled from declarations, see kernel.c
+typedef struct Kernel Kernel;
+// a body is parsed from its `source` when first applied (see `parse_body`);
+// until then it is `lazy` and empty
+// `shared` counts the body's shared subexpressions once it was first applied
+// (see `optimize_applied`)
+struct FunctionDeclarationAtom {
+    int arity; AtomList *parameters; AtomList *body; bool inline_frame; Kernel *kernel;
+    char *source; bool lazy, imports; OptimizeScope *enclosing; AtomList *substitutions;
+    int shared;
+};
+Atom *atom_functiondeclaration_new(int arity, AtomList *parameters, char *source, bool binds, bool imports);
 bool atom_functiondeclaration_is(Atom *atom);
 
-struct FunctionAtom { int arity; AtomList *parameters; AtomList *body; Atom *scope; char *primitive; };
-Atom *atom_function_new(int arity, AtomList *parameters, AtomList *body, Atom *scope, char *primitive);
+// the body, inline frame and kernel of a function are its declaration's
+struct FunctionAtom { int arity; AtomList *parameters; AtomList *body; Atom *scope; primitive_opcode primitive; FunctionDeclarationAtom *declaration; };
+Atom *atom_function_new(int arity, AtomList *parameters, AtomList *body, Atom *scope, primitive_opcode primitive);
 bool atom_function_is(Atom *atom);
-
-struct ScopeAtom { AtomList *names; AtomList *binds; Atom *upper_scope; bool is_main; bool is_selfref; bool is_frozen; };
+Atom *atom_closure_new(Atom *declaration, Atom *scope);
+const char *primitive_symbol(primitive_opcode primitive);
+
+// while a function body is interpreted, its call scope holds the values of
+// the body's shared subexpressions (see interpret.c); function declarations
+// bound within an import's scope are bound lazily (`is_import`, see
+// interpret.c)
+typedef struct { Atom *value; long imports; } SharedValue;
+struct ScopeAtom { AtomList *names; AtomList *binds; Atom *upper_scope; bool is_main; bool is_selfref; bool is_frozen; bool is_frame; bool is_import; unsigned long hash; Atom **table; long table_size; SharedValue *shared; };
 Atom *atom_scope_new(AtomList *names, AtomList *binds, Atom *upper_scope);
 Atom *atom_scope_freeze(Atom *atom);
 Atom *atom_scope_new_empty();
@@ -71,19 +94,62 @@ bool atom_scope_getflag_ismain(Atom *atom);
 void atom_scope_setflag_isselfref(Atom *atom, bool flg);
 bool atom_scope_getflag_isselfref(Atom *atom);
 
+void atom_scope_index(Atom *scope);
+void atom_scope_truncate(Atom *scope, long size);
+
 bool atom_scope_push(Atom *scope, Atom *name, Atom *bind);
+Atom *atom_scope_lookup_local(Atom *scope, Atom *name);
+Atom *atom_scope_lookup(Atom *scope, Atom *name);
 Atom *atom_scope_unbind(Atom *scope, Atom *name);
 bool atom_scope_contains_bind(Atom *scope, Atom *name);
 Atom *atom_scope_new_inherits(Atom *scope);
 Atom *atom_scope_new_fake(Atom *scope);
 
-struct StructInitializerAtom { Atom *type; AtomList *fields; };
+// a function declaration an import binds lazily (see interpret.c): its closure
+// over the import's scope is created when a lookup first finds the thunk and
+// is kept as its `value`
+struct ThunkAtom { Atom *declaration; Atom *scope; Atom *value; };
+Atom *atom_thunk_new(Atom *declaration, Atom *scope);
+bool atom_thunk_is(Atom *atom);
+Atom *atom_thunk_force(Atom *atom);
+
+// precedes an occurrence of a subexpression repeated in a function body,
+// whose value is kept in the call scope's `shared[slot]`; `end` is the node
+// following the occurrence (see optimize.c)
+struct SharedAtom { int slot; AtomListNode *end; };
+Atom *atom_shared_new(int slot, AtomListNode *end);
+bool atom_shared_is(Atom *atom);
+
+// precedes an application of a small function, which is interpreted as its
+// `expansion` as long as each guard's name is bound in its scope (NULL: the
+// one interpreted in) to its bind (NULL: to data); `end` is the node
+// following the application (see optimize.c)
+typedef struct { Atom *scope, *name, *bind; } InlineGuard;
+struct InlineAtom { AtomList *expansion; InlineGuard *guards; int guards_size; AtomListNode *end; };
+Atom *atom_inline_new(AtomList *expansion, InlineGuard *guards, int guards_size, AtomListNode *end);
+bool atom_inline_is(Atom *atom);
+
+// precedes an integer subexpression of a function body, which is evaluated
+// by `kernel` as long as the names it refers to are bound to integers and
+// to the main scope's primitives; `end` is the node following the
+// subexpression (see optimize.c)
+struct UnboxedAtom { Kernel *kernel; AtomListNode *end; };
+Atom *atom_unboxed_new(Kernel *kernel, AtomListNode *end);
+bool atom_unboxed_is(Atom *atom);
+
+// a struct initializer doubles as the shape of the structs it initializes;
+// `layout` holds the field names in slot order, a name repeated in `fields`
+// having a single slot, and `arity` is the number of fields it is applied to
+struct StructInitializerAtom { Atom *type; AtomList *fields; int arity, size; Atom **layout; unsigned long hash; };
 Atom *atom_structinitializer_new(Atom *type, AtomList *fields);
 bool atom_structinitializer_is(Atom *atom);
+int atom_structinitializer_slot(Atom *atom, Atom *field);
 
-struct StructAtom { Atom *type; Atom *scope; };
-Atom *atom_struct_new(Atom *type, Atom *scope);
+struct StructAtom { Atom *shape; Atom **slots; unsigned long hash; };
+Atom *atom_struct_new(Atom *shape, Atom **slots);
 bool atom_struct_is(Atom *atom);
+Atom *atom_struct_type(Atom *atom);
+Atom *atom_struct_field(Atom *atom, Atom *field);
 
 struct StringAtom { char *str; };
 Atom *atom_string_new(char *str);
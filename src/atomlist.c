@@ -2,6 +2,7 @@
 #include "atom.h"
 #include "debug.h"
 #include "memorymanagement.h"
+#include "stats.h"
 
 
 static AtomListNode *atomlistnode_new(Atom *atom, AtomListNode *next);
@@ -73,6 +74,14 @@ void atomlist_push_front(AtomList *lst, Atom *atom) {
     lst->head = node;
 }
 
+AtomListNode **atomlist_append(AtomListNode **end, Atom *atom) {
+    if (!end || !atom_is(atom))
+        return end;
+
+    *end = atomlistnode_new(atom, NULL);
+    return &(*end)->next;
+}
+
 Atom *atomlist_pop_front(AtomList *lst) {
     if (!atomlist_is(lst))
         return NULL;
@@ -114,10 +123,13 @@ AtomList *atomlist_copy(AtomList *lst) {
     if (!atomlist_is(lst))
         return NULL;
 
+    STAT(atomlist_copies++);
+
     AtomList *nlst = atomlist_new(NULL);
     AtomListNode **pnnode = &nlst->head;
     AtomListNode *node = lst->head;
     while (node) {
+        STAT(atomlist_copied_nodes++);
         *pnnode = atomlistnode_new(node->atom, NULL);
         pnnode = &(*pnnode)->next;
         node = node->next;
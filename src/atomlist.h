@@ -14,6 +14,8 @@ bool atomlist_is(AtomList *lst);
 
 void atomlist_push(AtomList *lst, Atom *atom);
 void atomlist_push_front(AtomList *lst, Atom *atom);
+// appends `atom` at `end`, a list's last next pointer, returning the new one
+AtomListNode **atomlist_append(AtomListNode **end, Atom *atom);
 Atom *atomlist_pop_front(AtomList *lst);
 int atomlist_len(AtomList *lst);
 bool atomlist_empty(AtomList *lst);
@@ -0,0 +1,103 @@
+#include <limits.h>
+#include <time.h>
+
+#include "budget.h"
+#include "debug.h"
+
+#include "context.h"
+
+
+/* Execution budgets (`--max-steps`, `--max-bytes`, `--max-time`)
+
+    A step is an atom interpreted or a kernel body evaluated. Steps are
+    counted down from at most `BUDGET_INTERVAL` and only at zero added up
+    and checked against the step and time budgets, so that a step costs a
+    decrement; allocated bytes are counted down in `mm_malloc`. Bytes are
+    counted as allocated, not as live, since `mm_free` does not know sizes.
+    A run exhausting a budget reports an error once and is then unwound:
+    every further step fails, interpreting to `ENull`, with errors and
+    warnings silenced until the run ends. */
+
+#define Budget (GlobContext->budget)
+
+static const char *budget_names[] = {
+    [krrp_budget_none] = "none",
+    [krrp_budget_steps] = "steps",
+    [krrp_budget_bytes] = "bytes",
+    [krrp_budget_time] = "time"
+};
+
+static double budget_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// count the steps taken since the countdown was armed
+static void budget_sync() {
+    Budget.steps += Budget.armed - Budget.countdown;
+    Budget.armed = Budget.countdown = 0;
+}
+
+static void budget_arm() {
+    long left = GlobOpt.maximum_steps > 0 ? GlobOpt.maximum_steps - Budget.steps : BUDGET_INTERVAL;
+    Budget.armed = Budget.countdown = left < BUDGET_INTERVAL ? left : BUDGET_INTERVAL;
+}
+
+void budget_start() {
+    Budget.steps = Budget.bytes = 0;
+    Budget.bytes_limit = Budget.bytes_left = GlobOpt.maximum_bytes > 0 ? GlobOpt.maximum_bytes : LONG_MAX;
+    Budget.start = Budget.stop = budget_now();
+    Budget.exhausted = krrp_budget_none;
+    budget_arm();
+}
+
+// neither steps nor allocations between runs count against a budget
+void budget_stop() {
+    budget_sync();
+    Budget.armed = Budget.countdown = LONG_MAX;
+    Budget.bytes = Budget.bytes_limit - Budget.bytes_left;
+    Budget.bytes_left = LONG_MAX;
+    Budget.stop = budget_now();
+
+    if (Budget.exhausted) {
+        GlobOpt.ERR = Budget.ERR;
+        GlobOpt.WRN = Budget.WRN;
+    }
+}
+
+bool budget_tick() {
+    if (Budget.exhausted) {
+        Budget.armed = Budget.countdown = 0;
+        return true;
+    }
+
+    budget_sync();
+    if (GlobOpt.maximum_steps > 0 && Budget.steps > GlobOpt.maximum_steps)
+        budget_exhaust(krrp_budget_steps);
+    else if (GlobOpt.maximum_seconds > 0 && budget_now() - Budget.start > GlobOpt.maximum_seconds)
+        budget_exhaust(krrp_budget_time);
+    else
+        budget_arm();
+
+    return Budget.exhausted;
+}
+
+void budget_exhaust(krrp_budget budget) {
+    if (Budget.exhausted)
+        return;
+
+    budget_sync();
+    Budget.exhausted = budget;
+    error("budget :: Exhausted the %s budget after %ld steps, %ld allocated bytes and %.3f s.\n",
+          budget_names[budget], Budget.steps, Budget.bytes_limit - Budget.bytes_left, budget_now() - Budget.start);
+
+    Budget.ERR = GlobOpt.ERR;
+    Budget.WRN = GlobOpt.WRN;
+    GlobOpt.ERR = GlobOpt.WRN = false;
+}
+
+void budget_print_json(FILE *f) {
+    fprintf(f, "{\"steps\": %ld, \"bytes\": %ld, \"seconds\": %.6f, \"exhausted\": \"%s\"}\n",
+            Budget.steps, Budget.bytes, Budget.stop - Budget.start, budget_names[Budget.exhausted]);
+}
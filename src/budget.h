@@ -0,0 +1,30 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "libkrrp.h"
+
+
+// steps taken between checks of the step and time budgets
+#define BUDGET_INTERVAL 4096
+
+typedef struct {
+    long countdown, armed, steps;
+    long bytes_left, bytes_limit, bytes;
+    double start, stop;
+    krrp_budget exhausted;
+    bool ERR, WRN;
+} BudgetState;
+
+// BUDGET_STEP() counts a step, true once a budget is exhausted
+#define BUDGET_STEP() (--GlobContext->budget.countdown < 0 && budget_tick())
+
+void budget_start();
+void budget_stop();
+bool budget_tick();
+void budget_exhaust(krrp_budget budget);
+void budget_print_json(FILE *f);
+
+#endif
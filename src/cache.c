@@ -0,0 +1,572 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "atom.h"
+#include "atomlist.h"
+#include "parse.h"
+#include "optimize.h"
+#include "memorymanagement.h"
+#include "stats.h"
+#include "debug.h"
+
+#include "context.h"
+
+
+/* Compiled-module cache (`--cache dir`)
+
+    Parsing and optimizing a source always yields the same atoms, so the
+    result is kept on disk: `cache_parse` maps `dir/<hash>.krrpc`, named
+    after the source's FNV-1a hash, and otherwise parses and optimizes the
+    source and writes that entry. An entry's header names the format, the
+    interpreter build and the optimization level it was written by, the
+    source's hash and length and its payload's length and hash; an entry
+    whose header does not match or whose payload does not decode is
+    ignored, and replaced.
+
+    The payload holds the names the program uses, each written once and
+    referred to by position, the bind counts of the scope the declarations'
+    bodies are optimized in (see optimize.c) and the program's atoms.
+    Function declarations are written as their parameters, the flags the
+    skimming parser noted, the source of their body, which is parsed when
+    first applied (see parse.c), and the constants propagated into it.
+    Counts and lengths are variable-length integers. Warnings the parser
+    reports are not repeated for a cached source. Entries are written to a
+    temporary file which is then renamed, so that concurrent runs never map
+    a partial one. */
+
+#define CACHE_FORMAT 2
+
+// `make` defines KRRP_BUILD as a checksum of the interpreter's sources, such
+// that entries written by a differently built interpreter are stale even if
+// OPTIMIZE_VERSION was not bumped
+#ifndef KRRP_BUILD
+#define KRRP_BUILD 0
+#endif
+
+typedef struct {
+    char magic[8];
+    uint32_t format, version;
+    uint64_t build;
+    int32_t optimization_level;
+    uint64_t source_hash, source_length;
+    uint64_t payload_length, payload_hash;
+} CacheHeader;
+
+static uint64_t cache_hash(const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    uint64_t hash = 14695981039346656037UL;
+    for (size_t j = 0; j < length; j++)
+        hash = (hash ^ bytes[j]) * 1099511628211UL;
+
+    return hash;
+}
+
+// the header an entry of a source has to start with, up to its payload
+static CacheHeader cache_header(uint64_t source_hash, size_t source_length) {
+    CacheHeader header;
+    memset(&header, 0, sizeof header);
+
+    memcpy(header.magic, "krrpc", 5);
+    header.format = CACHE_FORMAT;
+    header.version = OPTIMIZE_VERSION;
+    header.build = KRRP_BUILD;
+    header.optimization_level = GlobOpt.optimization_level;
+    header.source_hash = source_hash;
+    header.source_length = source_length;
+
+    return header;
+}
+
+
+/* Encoding */
+
+typedef struct { unsigned char *data; size_t size, capacity; } CacheBuffer;
+
+static void cache_put(CacheBuffer *b, const void *data, size_t n) {
+    if (b->size + n > b->capacity) {
+        size_t capacity = b->capacity > 0 ? 2 * b->capacity : 256;
+        while (capacity < b->size + n)
+            capacity *= 2;
+
+        unsigned char *grown = mm_malloc("cache: buffer", capacity);
+        if (b->data) {
+            memcpy(grown, b->data, b->size);
+            mm_free("cache: buffer", b->data);
+        }
+        b->data = grown;
+        b->capacity = capacity;
+    }
+
+    memcpy(b->data + b->size, data, n);
+    b->size += n;
+}
+
+static void cache_put_byte(CacheBuffer *b, unsigned char byte) { cache_put(b, &byte, 1); }
+
+static void cache_put_varint(CacheBuffer *b, uint64_t value) {
+    for (; value >= 0x80; value >>= 7)
+        cache_put_byte(b, (value & 0x7F) | 0x80);
+    cache_put_byte(b, value);
+}
+
+typedef struct {
+    CacheBuffer atoms;
+    Atom **names;
+    long names_size, names_capacity;
+    // one more than the position of the name of each symbol id, if any
+    long *positions;
+    long positions_size;
+    OptimizeScope *scope;
+    bool ok;
+} CacheEncoder;
+
+static void cache_put_name(CacheEncoder *e, Atom *name) {
+    long id = ((NameAtom *) name->atom)->id;
+    if (id >= e->positions_size)
+        { e->ok = false; return; }
+
+    if (!e->positions[id]) {
+        if (e->names_size >= e->names_capacity) {
+            long capacity = e->names_capacity > 0 ? 2 * e->names_capacity : 64;
+            Atom **names = mm_malloc("cache: names", capacity * sizeof *names);
+            for (long j = 0; j < e->names_size; j++)
+                names[j] = e->names[j];
+            if (e->names)
+                mm_free("cache: names", e->names);
+            e->names = names;
+            e->names_capacity = capacity;
+        }
+
+        e->names[e->names_size++] = name;
+        e->positions[id] = e->names_size;
+    }
+
+    cache_put_varint(&e->atoms, e->positions[id] - 1);
+}
+
+static void cache_put_names(CacheEncoder *e, AtomList *names) {
+    cache_put_varint(&e->atoms, atomlist_len(names));
+    for (AtomListNode *node = names->head; node; node = node->next)
+        cache_put_name(e, node->atom);
+}
+
+static void cache_put_atom(CacheEncoder *e, Atom *atom) {
+    switch (atom->type) {
+        case atom_type_name:
+            cache_put_byte(&e->atoms, 'n');
+            cache_put_name(e, atom);
+            return;
+
+        case atom_type_integer: {
+            integer value = ((IntegerAtom *) atom->atom)->value;
+            cache_put_byte(&e->atoms, 'i');
+            cache_put_varint(&e->atoms, ((uint64_t) value << 1) ^ (uint64_t) (value < 0 ? -1 : 0));
+            return;
+        }
+
+        case atom_type_primitive:
+            cache_put_byte(&e->atoms, 'p');
+            cache_put_byte(&e->atoms, ((PrimitiveAtom *) atom->atom)->c);
+            return;
+
+        case atom_type_structinitializer: {
+            StructInitializerAtom *structinitializer_atom = atom->atom;
+            if (!atom_name_is(structinitializer_atom->type))
+                break;
+
+            cache_put_byte(&e->atoms, 's');
+            cache_put_name(e, structinitializer_atom->type);
+            cache_put_names(e, structinitializer_atom->fields);
+            return;
+        }
+
+        case atom_type_functiondeclaration: {
+            FunctionDeclarationAtom *fd = atom->atom;
+            if (!fd->lazy || (fd->enclosing && e->scope && fd->enclosing != e->scope))
+                break;
+            if (fd->enclosing)
+                e->scope = fd->enclosing;
+
+            // a declaration binds if its frame cannot be inlined (see atom.c)
+            cache_put_byte(&e->atoms, 'f');
+            cache_put_names(e, fd->parameters);
+            cache_put_byte(&e->atoms, (!fd->inline_frame) | fd->imports << 1 | (!!fd->enclosing) << 2);
+
+            size_t length = strlen(fd->source);
+            cache_put_varint(&e->atoms, length);
+            cache_put(&e->atoms, fd->source, length);
+
+            long pairs = fd->substitutions ? atomlist_len(fd->substitutions) / 2 : 0;
+            cache_put_varint(&e->atoms, pairs);
+            for (AtomListNode *node = pairs ? fd->substitutions->head : NULL; node; node = node->next->next) {
+                cache_put_name(e, node->atom);
+                cache_put_atom(e, node->next->atom);
+            }
+            return;
+        }
+
+        default:
+            break;
+    }
+
+    e->ok = false;
+}
+
+// the payload of `parsed` into `payload`; false if it cannot be cached
+static bool cache_encode(AtomList *parsed, CacheBuffer *payload) {
+    CacheEncoder e = { .ok = true };
+    e.positions_size = GlobContext->name_count;
+    e.positions = mm_malloc("cache: positions", (e.positions_size > 0 ? e.positions_size : 1) * sizeof *e.positions);
+    for (long j = 0; j < e.positions_size; j++)
+        e.positions[j] = 0;
+
+    long size = 0;
+    for (AtomListNode *node = parsed->head; node && e.ok; node = node->next, size++)
+        cache_put_atom(&e, node->atom);
+
+    // every name the scope counts binds of is one of the program's
+    long counted = 0, written = 0;
+    if (e.scope) {
+        for (long j = 0; j < e.scope->binds_size; j++)
+            counted += e.scope->binds[j] > 0;
+        for (long j = 0; j < e.names_size; j++) {
+            long id = ((NameAtom *) e.names[j]->atom)->id;
+            written += id < e.scope->binds_size && e.scope->binds[id] > 0;
+        }
+    }
+
+    if (e.ok && counted == written) {
+        cache_put_varint(payload, e.names_size);
+        for (long j = 0; j < e.names_size; j++) {
+            const char *name = ((NameAtom *) e.names[j]->atom)->name;
+            cache_put_varint(payload, strlen(name));
+            cache_put(payload, name, strlen(name));
+        }
+
+        cache_put_byte(payload, !!e.scope);
+        if (e.scope) {
+            cache_put_byte(payload, e.scope->imports);
+            cache_put_varint(payload, written);
+            for (long j = 0; j < e.names_size; j++) {
+                long id = ((NameAtom *) e.names[j]->atom)->id;
+                if (id < e.scope->binds_size && e.scope->binds[id] > 0) {
+                    cache_put_varint(payload, j);
+                    cache_put_varint(payload, e.scope->binds[id]);
+                }
+            }
+        }
+
+        cache_put_varint(payload, size);
+        cache_put(payload, e.atoms.data, e.atoms.size);
+    }
+
+    if (e.atoms.data)
+        mm_free("cache: buffer", e.atoms.data);
+    if (e.names)
+        mm_free("cache: names", e.names);
+    mm_free("cache: positions", e.positions);
+
+    return e.ok && counted == written;
+}
+
+static void cache_store(const char *directory, const char *path, AtomList *parsed, uint64_t source_hash, size_t source_length) {
+    CacheBuffer payload = { 0 };
+    if (!cache_encode(parsed, &payload)) {
+        info("cache :: Source cannot be cached.\n");
+        if (payload.data)
+            mm_free("cache: buffer", payload.data);
+        return;
+    }
+
+    CacheHeader header = cache_header(source_hash, source_length);
+    header.payload_length = payload.size;
+    header.payload_hash = cache_hash(payload.data, payload.size);
+
+    mkdir(directory, 0777);
+    char *temporary = mm_malloc("cache: path", strlen(path) + 32);
+    sprintf(temporary, "%s.%ld.tmp", path, (long) getpid());
+
+    FILE *f = fopen(temporary, "wb");
+    bool written = f
+        && fwrite(&header, sizeof header, 1, f) == 1
+        && fwrite(payload.data, 1, payload.size, f) == payload.size;
+    if (f && fclose(f) != 0)
+        written = false;
+
+    if (written && rename(temporary, path) == 0)
+        info("cache :: Wrote `%s`.\n", path);
+    else {
+        warning("cache :: Could not write `%s`.\n", path);
+        if (f)
+            unlink(temporary);
+    }
+
+    mm_free("cache: path", temporary);
+    mm_free("cache: buffer", payload.data);
+}
+
+
+/* Decoding */
+
+typedef struct {
+    const unsigned char *p, *end;
+    Atom **names;
+    long names_size;
+    OptimizeScope *scope;
+    bool ok;
+} CacheDecoder;
+
+static const unsigned char *cache_get(CacheDecoder *d, uint64_t n) {
+    if (!d->ok || (uint64_t) (d->end - d->p) < n)
+        return d->ok = false, NULL;
+
+    const unsigned char *p = d->p;
+    d->p += n;
+    return p;
+}
+
+static uint64_t cache_get_varint(CacheDecoder *d) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64 && d->ok && d->p < d->end; shift += 7) {
+        unsigned char byte = *d->p++;
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+
+    return d->ok = false, 0;
+}
+
+// a count of items which each take at least one more byte
+static uint64_t cache_get_count(CacheDecoder *d) {
+    uint64_t count = cache_get_varint(d);
+    if ((uint64_t) (d->end - d->p) < count)
+        return d->ok = false, 0;
+
+    return count;
+}
+
+static Atom *cache_get_name(CacheDecoder *d) {
+    uint64_t j = cache_get_varint(d);
+    if (!d->ok || j >= (uint64_t) d->names_size)
+        return d->ok = false, NULL;
+
+    return d->names[j];
+}
+
+static AtomList *cache_get_names(CacheDecoder *d) {
+    AtomList *names = atomlist_new(NULL);
+    AtomListNode **end = &names->head;
+    for (uint64_t count = cache_get_count(d); count > 0 && d->ok; count--) {
+        Atom *name = cache_get_name(d);
+        if (d->ok)
+            end = atomlist_append(end, name);
+    }
+
+    return names;
+}
+
+static Atom *cache_get_atom(CacheDecoder *d) {
+    const unsigned char *tag = cache_get(d, 1);
+    if (!tag)
+        return NULL;
+
+    switch (*tag) {
+        case 'n':
+            return cache_get_name(d);
+
+        case 'i': {
+            uint64_t value = cache_get_varint(d);
+            return d->ok ? atom_integer_new((integer) (value >> 1) ^ -(integer) (value & 1)) : NULL;
+        }
+
+        case 'p': {
+            const unsigned char *c = cache_get(d, 1);
+            return c ? atom_primitive_new(*c) : NULL;
+        }
+
+        case 's': {
+            Atom *type = cache_get_name(d);
+            AtomList *fields = cache_get_names(d);
+            if (!d->ok)
+                return atomlist_free(fields), NULL;
+
+            return atom_structinitializer_new(type, fields);
+        }
+
+        case 'f': {
+            AtomList *parameters = cache_get_names(d);
+            const unsigned char *flags = cache_get(d, 1);
+            uint64_t length = cache_get_varint(d);
+            const unsigned char *body = cache_get(d, length);
+            if (!d->ok || (*flags & 4 && !d->scope))
+                return atomlist_free(parameters), d->ok = false, NULL;
+
+            char *source = mm_malloc("parse_functiondeclaration", length + 1);
+            memcpy(source, body, length);
+            source[length] = '\0';
+
+            Atom *atom = atom_functiondeclaration_new(atomlist_len(parameters), parameters, source, *flags & 1, *flags & 2);
+            FunctionDeclarationAtom *fd = atom->atom;
+            if (*flags & 4) {
+                fd->enclosing = d->scope;
+                d->scope->references++;
+            }
+
+            AtomListNode **end = NULL;
+            for (uint64_t pairs = cache_get_count(d); pairs > 0 && d->ok; pairs--) {
+                Atom *name = cache_get_name(d);
+                Atom *value = cache_get_atom(d);
+                if (!d->ok)
+                    break;
+
+                if (!fd->substitutions)
+                    end = &(fd->substitutions = atomlist_new(NULL))->head;
+                end = atomlist_append(atomlist_append(end, name), value);
+            }
+
+            return atom;
+        }
+
+        default:
+            return d->ok = false, NULL;
+    }
+}
+
+static AtomList *cache_decode(const unsigned char *payload, size_t length) {
+    CacheDecoder d = { .p = payload, .end = payload + length, .ok = true };
+
+    d.names_size = cache_get_count(&d);
+    d.names = mm_malloc("cache: names", (d.names_size > 0 ? d.names_size : 1) * sizeof *d.names);
+    for (long j = 0; j < d.names_size && d.ok; j++) {
+        uint64_t size = cache_get_varint(&d);
+        const unsigned char *name = cache_get(&d, size);
+        if (!name || memchr(name, '\0', size)) {
+            d.ok = false, d.names_size = j;
+            break;
+        }
+
+        char *str = mm_malloc("cache: name", size + 1);
+        memcpy(str, name, size);
+        str[size] = '\0';
+        d.names[j] = atom_name_new(str);
+    }
+
+    const unsigned char *has_scope = cache_get(&d, 1);
+    if (has_scope && *has_scope) {
+        const unsigned char *imports = cache_get(&d, 1);
+        uint64_t count = cache_get_count(&d);
+
+        long size = 0;
+        for (long j = 0; j < d.names_size && d.ok; j++) {
+            long id = ((NameAtom *) d.names[j]->atom)->id;
+            if (id >= size)
+                size = id + 1;
+        }
+
+        d.scope = mm_malloc("optimize: scope", sizeof *d.scope);
+        d.scope->binds = size > 0 ? mm_malloc("optimize: scope binds", size * sizeof *d.scope->binds) : NULL;
+        for (long j = 0; j < size; j++)
+            d.scope->binds[j] = 0;
+        d.scope->binds_size = size;
+        d.scope->imports = imports && *imports;
+        d.scope->references = 0;
+
+        for (; count > 0 && d.ok; count--) {
+            Atom *name = cache_get_name(&d);
+            uint64_t binds = cache_get_varint(&d);
+            if (d.ok)
+                d.scope->binds[((NameAtom *) name->atom)->id] = binds;
+        }
+    }
+
+    AtomList *parsed = new_boxed_atomlist();
+    AtomListNode **end = &parsed->head;
+    for (uint64_t size = cache_get_count(&d); size > 0 && d.ok; size--) {
+        Atom *atom = cache_get_atom(&d);
+        if (d.ok)
+            end = atomlist_append(end, atom);
+    }
+
+    // the scope is freed along with the last declaration it encloses
+    if (d.scope && d.scope->references == 0)
+        optimize_scope_release(d.scope);
+    mm_free("cache: names", d.names);
+
+    if (!d.ok || d.p != d.end)
+        return atomlist_free(parsed), NULL;
+    return parsed;
+}
+
+// the program a valid entry at `path` holds, NULL if there is none
+static AtomList *cache_load(const char *path, uint64_t source_hash, size_t source_length) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(CacheHeader))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return info("cache :: Ignoring unreadable `%s`.\n", path), NULL;
+
+    CacheHeader header, expected = cache_header(source_hash, source_length);
+    memcpy(&header, map, sizeof header);
+    const unsigned char *payload = (const unsigned char *) map + sizeof header;
+    size_t length = st.st_size - sizeof header;
+
+    AtomList *parsed = NULL;
+    if (memcmp(&header, &expected, offsetof(CacheHeader, payload_length)) != 0)
+        info("cache :: Ignoring stale `%s`.\n", path);
+    else if (header.payload_length != length || header.payload_hash != cache_hash(payload, length)
+    || !(parsed = cache_decode(payload, length)))
+        info("cache :: Ignoring corrupt `%s`.\n", path);
+    else
+        info("cache :: Loaded `%s`.\n", path);
+
+    munmap(map, st.st_size);
+    return parsed;
+}
+
+
+AtomList *cache_parse(const char *source) {
+    // what a source optimizes to depends on the names a prelude binds
+    const char *directory = GlobOpt.cache_directory;
+    if (!directory || GlobContext->prelude) {
+        AtomList *parsed = parse(source);
+        optimize(parsed);
+        return parsed;
+    }
+
+    size_t length = strlen(source);
+    uint64_t hash = cache_hash(source, length);
+
+    char *path = mm_malloc("cache: path", strlen(directory) + 32);
+    sprintf(path, "%s/%016llx.krrpc", directory, (unsigned long long) hash);
+
+    AtomList *parsed = cache_load(path, hash, length);
+    if (parsed)
+        STAT(cache_hits++);
+    else {
+        STAT(cache_misses++);
+        parsed = parse(source);
+        optimize(parsed);
+        if (parsed)
+            cache_store(directory, path, parsed, hash, length);
+    }
+
+    mm_free("cache: path", path);
+    return parsed;
+}
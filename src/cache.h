@@ -0,0 +1,11 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "atomlist.h"
+
+
+// parse and optimize `source`, through the compiled-module cache if the
+// option `cache_directory` is set; NULL if it could not be parsed
+AtomList *cache_parse(const char *source);
+
+#endif
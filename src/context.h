@@ -0,0 +1,66 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <setjmp.h>
+
+#include "typedefs.h"
+#include "Opt.h"
+#include "stats.h"
+#include "memorymanagement.h"
+#include "budget.h"
+#include "libkrrp.h"
+
+
+typedef struct ProfileState ProfileState;
+typedef struct TraceState TraceState;
+typedef struct MemProfileState MemProfileState;
+
+/* Interpreter context
+
+    Everything an interpreter instance mutates lives in its context: options,
+    counters, the global atom tables with their index and imported sources
+    and the state of the profiler, tracer and allocation profiler (the latter
+    three allocated on first use). Each thread interprets in its current
+    context, `GlobContext`; the names the interpreter used to have as
+    globals refer to its fields. Process-wide remain only the registered
+    kernel natives, which are never modified while interpreting, and the
+    signal flags of `--stats` and `--heap-report`. */
+
+struct krrp_context {
+    Opt opt;
+    long error_count;
+    Stats stats;
+    MemoryManagementDebug mm;
+    BudgetState budget;
+
+    AtomList *atom_table, *atom_table_mutable;
+    Atom *null_atom, *nullcondition_atom, *nullscope_atom, *Enull_atom;
+    Atom *imported_source;
+    AtomList *atom_index;
+    long atom_index_size, atom_index_count;
+    long name_count;
+
+    Atom *main_scope, *prelude;
+    MemoryCheckpoint checkpoint;
+    long imports;
+    jmp_buf bail;
+
+    ProfileState *profile;
+    TraceState *trace;
+    MemProfileState *memory_profile;
+};
+
+extern _Thread_local krrp_context *GlobContext;
+
+#define GlobOpt (GlobContext->opt)
+#define ErrorCount (GlobContext->error_count)
+#define GlobStats (GlobContext->stats)
+#define GlobalAtomTable (GlobContext->atom_table)
+#define GlobalAtomTableMutable (GlobContext->atom_table_mutable)
+#define ImportedSource (GlobContext->imported_source)
+
+// make `ctx` the current context, returning the one it replaces
+krrp_context *context_enter(krrp_context *ctx);
+void context_leave(krrp_context *previous);
+
+#endif
@@ -3,11 +3,11 @@
 
 #include <stdio.h>
 
-#include "Opt.h"
-extern Opt GlobOpt;
+#include "context.h"
 
 
-#define error(...) (GlobOpt.ERR && fprintf(stderr, "*** Error: " __VA_ARGS__))
+// errors are counted even when not printed
+#define error(...) (ErrorCount++, GlobOpt.ERR && fprintf(stderr, "*** Error: " __VA_ARGS__))
 #define warning(...) (GlobOpt.WRN && fprintf(stderr, "*** Warning: " __VA_ARGS__))
 #define info(...) (GlobOpt.INF && fprintf(stderr, "*** Info: " __VA_ARGS__))
 
@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "emit.h"
+#include "atom.h"
+#include "atomlist.h"
+#include "parse.h"
+#include "optimize.h"
+#include "kernel.h"
+#include "memorymanagement.h"
+#include "debug.h"
+#include "util.h"
+
+#include "context.h"
+
+
+/* Ahead-of-time compilation to C (`--emit-c`)
+
+    The programs and everything they import are parsed and optimized as
+    they would be when interpreted, and every integer kernel found is
+    emitted as a C function: primitives become C arithmetic, `?`, `|` and
+    `&` branches and `@` recursive calls. The generated translation unit
+    embeds the programs' sources, those of imports which are no part of the
+    standard library and a table of its kernels by signature; its `main`
+    interprets the programs like `krrp` does, calling the compiled kernels
+    wherever the interpreter would apply them. */
+
+typedef struct {
+    FILE *f;
+    Kernel **kernels;
+    long kernels_size;
+    AtomList *imported;
+    AtomList *imports;
+    long temporaries;
+} Emitter;
+
+
+static void emit_string(FILE *f, const char *str) {
+    fprintf(f, "\"");
+    for (const unsigned char *c = (const unsigned char *) str; *c; c++) {
+        if (*c == '\n')
+            fprintf(f, "\\n\"\n    \"");
+        else if (*c == '\\' || *c == '"')
+            fprintf(f, "\\%c", *c);
+        else if (*c < ' ' || *c > '~' || *c == '?')
+            fprintf(f, "\\%03o", *c);
+        else
+            fputc(*c, f);
+    }
+    fprintf(f, "\"");
+}
+
+static void emit_indent(Emitter *e, int indent) {
+    for (int j = 0; j < indent; j++)
+        fprintf(e->f, "    ");
+}
+
+
+// find the kernels in a program and, recursively, in what it imports
+static void emit_collect(Emitter *e, AtomList *lst);
+
+static void emit_collect_import(Emitter *e, Atom *name) {
+    if (strcmp(((NameAtom *) name->atom)->name, "]M") == 0)
+        return;
+    for (AtomListNode *node = e->imported->head; node; node = node->next)
+        if (node->atom == name)
+            return;
+    atomlist_push(e->imported, name);
+
+    Atom *source = atom_scope_lookup_local(ImportedSource, name);
+    if (!source) {
+        source = atom_string_read_from_file(string_from_atom(name));
+        if (!atom_string_is(source)) {
+            warning("emit :: Could not read import `%s`; it is left to be imported at runtime.\n", string_from_atom(name));
+            return;
+        }
+
+        atomlist_push(e->imports, name);
+        atomlist_push(e->imports, source);
+    }
+
+    AtomList *parsed = parse(string_from_atom(source));
+    if (!parsed)
+        return;
+
+    optimize(parsed);
+    emit_collect(e, parsed);
+}
+
+static void emit_collect(Emitter *e, AtomList *lst) {
+    for (AtomListNode *node = lst->head; node; node = node->next) {
+        Atom *atom = node->atom;
+
+        if (atom_primitive_is(atom) && ((PrimitiveAtom *) atom->atom)->c == '\\'
+        && node->next && atom_name_is(node->next->atom))
+            emit_collect_import(e, node->next->atom);
+
+        if (!atom_functiondeclaration_is(atom))
+            continue;
+
+        FunctionDeclarationAtom *fd = atom->atom;
+        if (!parse_body(fd))
+            continue;
+        emit_collect(e, fd->body);
+        if (!fd->kernel)
+            continue;
+
+        // identical kernels share one function
+        char *signature = kernel_signature(fd->kernel);
+        bool known = false;
+        for (long j = 0; j < e->kernels_size && !known; j++) {
+            char *other = kernel_signature(e->kernels[j]);
+            known = strcmp(signature, other) == 0;
+            mm_free("emit: signature", other);
+        }
+        mm_free("emit: signature", signature);
+
+        if (known)
+            continue;
+
+        Kernel **kernels = mm_malloc("emit: kernels", (e->kernels_size+1) * sizeof *kernels);
+        for (long j = 0; j < e->kernels_size; j++)
+            kernels[j] = e->kernels[j];
+        kernels[e->kernels_size] = fd->kernel;
+        if (e->kernels)
+            mm_free("emit: kernels", e->kernels);
+        e->kernels = kernels;
+        e->kernels_size++;
+    }
+}
+
+
+static void emit_integer(char *value, integer v) {
+    if (v == LONG_MIN)
+        sprintf(value, "(-%ldL - 1)", LONG_MAX);
+    else
+        sprintf(value, "%ldL", v);
+}
+
+/* Emit the statements computing a node into a fresh temporary and write the
+   C expression of its value to `value`. Overflowing arithmetic wraps, as
+   it does for the interpreter. */
+static void emit_node(Emitter *e, long index, KernelNode *node, char *value, int indent) {
+    static const char *operators[] = {
+        [primitive_modulo] = "%", [primitive_multiply] = "*", [primitive_add] = "+",
+        [primitive_subtract] = "-", [primitive_divide] = "/", [primitive_less] = "<",
+        [primitive_equal] = "==", [primitive_greater] = ">"
+    };
+
+    char a[64], b[64], c[64];
+    FILE *f = e->f;
+
+    if (node->operation == kernel_constant) {
+        emit_integer(value, node->value);
+        return;
+    }
+    if (node->operation == kernel_parameter) {
+        sprintf(value, "p%ld", node->value);
+        return;
+    }
+    if (node->operation == kernel_captured) {
+        sprintf(value, "c%ld", node->value);
+        return;
+    }
+
+    long t = e->temporaries++;
+    sprintf(value, "t%ld", t);
+
+    switch (node->operation) {
+        case kernel_primitive: {
+            emit_node(e, index, node->operands[0], a, indent);
+            emit_node(e, index, node->operands[1], b, indent);
+
+            primitive_opcode p = node->primitive;
+            if (p == primitive_divide || p == primitive_modulo) {
+                emit_indent(e, indent);
+                fprintf(f, "if (%s == 0 || (%s == -1 && %s == LONG_MIN))\n", b, b, a);
+                emit_indent(e, indent+1);
+                fprintf(f, "kernel_bail();\n");
+            }
+
+            emit_indent(e, indent);
+            if (p == primitive_add || p == primitive_subtract || p == primitive_multiply)
+                fprintf(f, "integer t%ld = (integer) ((unsigned long) %s %s (unsigned long) %s);\n", t, a, operators[p], b);
+            else
+                fprintf(f, "integer t%ld = %s %s %s;\n", t, a, operators[p], b);
+            break;
+        }
+
+        case kernel_conditional:
+            emit_node(e, index, node->operands[0], c, indent);
+            emit_indent(e, indent);
+            fprintf(f, "integer t%ld;\n", t);
+            emit_indent(e, indent);
+            fprintf(f, "if (%s) {\n", c);
+            emit_node(e, index, node->operands[1], a, indent+1);
+            emit_indent(e, indent+1);
+            fprintf(f, "t%ld = %s;\n", t, a);
+            emit_indent(e, indent);
+            fprintf(f, "}\n");
+            emit_indent(e, indent);
+            fprintf(f, "else {\n");
+            emit_node(e, index, node->operands[2], b, indent+1);
+            emit_indent(e, indent+1);
+            fprintf(f, "t%ld = %s;\n", t, b);
+            emit_indent(e, indent);
+            fprintf(f, "}\n");
+            break;
+
+        // `|` chooses a non-zero first argument, `&` a zero one
+        case kernel_or:
+        case kernel_and:
+            emit_node(e, index, node->operands[0], a, indent);
+            emit_indent(e, indent);
+            fprintf(f, "integer t%ld = %s;\n", t, a);
+            emit_indent(e, indent);
+            fprintf(f, "if (%st%ld) {\n", node->operation == kernel_or ? "!" : "", t);
+            emit_node(e, index, node->operands[1], b, indent+1);
+            emit_indent(e, indent+1);
+            fprintf(f, "t%ld = %s;\n", t, b);
+            emit_indent(e, indent);
+            fprintf(f, "}\n");
+            break;
+
+        case kernel_recurse: {
+            char (*arguments)[64] = mm_malloc("emit: arguments", (node->size > 0 ? node->size : 1) * sizeof *arguments);
+            for (int j = 0; j < node->size; j++)
+                emit_node(e, index, node->operands[j], arguments[j], indent);
+
+            // the called body is interpreted one level deeper than `@`
+            emit_indent(e, indent);
+            fprintf(f, "integer t%ld = kernel_%ld(depth + %d", t, index, node->depth + 1);
+            for (int j = 0; j < node->size; j++)
+                fprintf(f, ", %s", arguments[j]);
+            for (int j = 0; j < e->kernels[index]->captures_size; j++)
+                fprintf(f, ", c%d", j);
+            fprintf(f, ");\n");
+
+            mm_free("emit: arguments", arguments);
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+static void emit_kernel(Emitter *e, long index) {
+    Kernel *kernel = e->kernels[index];
+    FILE *f = e->f;
+
+    char *signature = kernel_signature(kernel);
+    fprintf(f, "// %s\n", signature);
+    mm_free("emit: signature", signature);
+
+    fprintf(f, "static integer kernel_%ld(long depth", index);
+    for (int j = 0; j < kernel->arity; j++)
+        fprintf(f, ", integer p%d", j);
+    for (int j = 0; j < kernel->captures_size; j++)
+        fprintf(f, ", integer c%d", j);
+    fprintf(f, ") {\n");
+
+    fprintf(f, "    if (depth + %d >= GlobOpt.maximum_interpretation_recursion_depth || BUDGET_STEP())\n", kernel->depth + 1);
+    fprintf(f, "        kernel_bail();\n\n");
+
+    char value[64];
+    e->temporaries = 0;
+    emit_node(e, index, kernel->body, value, 1);
+    fprintf(f, "    return %s;\n}\n\n", value);
+
+    fprintf(f, "static integer kernel_%ld_native(long depth, const integer *arguments) {\n", index);
+    fprintf(f, "    return kernel_%ld(depth", index);
+    for (int j = 0; j < kernel->arity + kernel->captures_size; j++)
+        fprintf(f, ", arguments[%d]", j);
+    fprintf(f, ");\n}\n\n");
+}
+
+
+bool emit_c(const char *filename, AtomList *codes) {
+    FILE *f = fopen(filename, "w");
+    if (!f)
+        return error("emit :: Could not open `%s` for writing.\n", filename), false;
+
+    Emitter e = {
+        .f = f,
+        .kernels = NULL,
+        .kernels_size = 0,
+        .imported = new_boxed_atomlist(),
+        .imports = new_boxed_atomlist(),
+        .temporaries = 0
+    };
+
+    for (AtomListNode *node = codes->head; node; node = node->next) {
+        AtomList *parsed = parse(string_from_atom(node->atom));
+        if (!parsed)
+            return fclose(f), error("emit :: Could not parse source.\n"), false;
+
+        optimize(parsed);
+        emit_collect(&e, parsed);
+    }
+
+    fprintf(f, "/* Generated by `krrp --emit-c`; build it with the krrp runtime, e.g.\n");
+    fprintf(f, "       cc -O2 -Isrc program.c $(ls src/*.c | grep -v src/krrp.c) -o program */\n\n");
+    fprintf(f, "#include <stdio.h>\n#include <stdlib.h>\n#include <limits.h>\n\n");
+    fprintf(f, "#include \"atom.h\"\n#include \"parse.h\"\n#include \"interpret.h\"\n#include \"optimize.h\"\n");
+    fprintf(f, "#include \"kernel.h\"\n#include \"memorymanagement.h\"\n#include \"util.h\"\n\n");
+    fprintf(f, "#include \"libkrrp.h\"\n#include \"context.h\"\n\n\n");
+
+    for (long j = 0; j < e.kernels_size; j++) {
+        fprintf(f, "static integer kernel_%ld(long depth", j);
+        for (int k = 0; k < e.kernels[j]->arity + e.kernels[j]->captures_size; k++)
+            fprintf(f, ", integer");
+        fprintf(f, ");\n");
+    }
+    fprintf(f, "\n");
+
+    for (long j = 0; j < e.kernels_size; j++)
+        emit_kernel(&e, j);
+
+    fprintf(f, "static const KernelEntry natives[] = {\n");
+    for (long j = 0; j < e.kernels_size; j++) {
+        char *signature = kernel_signature(e.kernels[j]);
+        fprintf(f, "    { ");
+        emit_string(f, signature);
+        fprintf(f, ", kernel_%ld_native },\n", j);
+        mm_free("emit: signature", signature);
+    }
+    fprintf(f, "    { NULL, NULL }\n};\n\n");
+
+    fprintf(f, "static const char *imports[] = {\n");
+    for (AtomListNode *node = e.imports->head; node; node = node->next) {
+        fprintf(f, "    ");
+        emit_string(f, string_from_atom(node->atom));
+        fprintf(f, ",\n");
+    }
+    fprintf(f, "    NULL\n};\n\n");
+
+    fprintf(f, "static const char *sources[] = {\n");
+    for (AtomListNode *node = codes->head; node; node = node->next) {
+        fprintf(f, "    ");
+        emit_string(f, string_from_atom(node->atom));
+        fprintf(f, ",\n");
+    }
+    fprintf(f, "    NULL\n};\n\n\n");
+
+    fprintf(f,
+        "int main(int argc, char **argv) {\n"
+        "    krrp_context *ctx = krrp_context_new();\n"
+        "    if (!ctx)\n"
+        "        return EXIT_FAILURE;\n"
+        "    krrp_options(ctx)->optimization_level = %d;\n"
+        "    kernel_natives(natives, %ld);\n"
+        "\n"
+        "    for (long j = 0; imports[j]; j += 2)\n"
+        "        krrp_import(ctx, imports[j], imports[j+1]);\n"
+        "\n"
+        "    for (long j = 0; sources[j]; j++)\n"
+        "        if (!krrp_run(ctx, sources[j], stdout))\n"
+        "            return krrp_context_free(ctx), EXIT_FAILURE;\n"
+        "\n"
+        "    krrp_context_free(ctx);\n"
+        "    return EXIT_SUCCESS;\n"
+        "}\n",
+        GlobOpt.optimization_level, e.kernels_size);
+
+    if (e.kernels)
+        mm_free("emit: kernels", e.kernels);
+
+    info("emit :: Wrote %ld kernels to `%s`.\n", e.kernels_size, filename);
+    return fclose(f) == 0;
+}
@@ -0,0 +1,11 @@
+#ifndef EMIT_H
+#define EMIT_H
+
+#include <stdbool.h>
+
+#include "atomlist.h"
+
+
+bool emit_c(const char *filename, AtomList *codes);
+
+#endif
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include "heapreport.h"
+#include "atom.h"
+#include "atomlist.h"
+#include "debug.h"
+
+
+
+/* Heap composition report (`--heap-report`)
+
+    Walks both global atom tables, which together hold every live atom, and
+    reports atom counts and an estimate of the bytes they own per atom type,
+    the largest strings and scopes and the longest scope chains kept alive by
+    closures. Bytes include the atom, its payload, its global table node and
+    whatever the payload exclusively owns (names, strings, lists, slots).
+    Functions share their parameters and body with their declaration, which
+    is where those are counted.
+
+    Scopes may refer to upper scopes which have been freed after being found
+    equal to an interned frozen scope, so only pointers to atoms found in the
+    global tables are followed. */
+
+#define HEAP_REPORT_TOP 10
+
+volatile sig_atomic_t HeapReportRequested = 0;
+
+static void heap_report_signal_handler(int signal) {
+    HeapReportRequested = 1;
+}
+
+void heap_report_install_signal_handler() {
+    struct sigaction action = { .sa_handler = heap_report_signal_handler };
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+
+    if (sigaction(SIGUSR2, &action, NULL) != 0)
+        warning("heap report :: Could not install SIGUSR2 handler.\n");
+}
+
+
+typedef struct { Atom **atoms; long capacity; } HeapSet;
+
+static unsigned long heap_hash(Atom *atom) {
+    unsigned long h = (unsigned long) atom;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    return h;
+}
+
+static void heap_set_insert(HeapSet *set, Atom *atom) {
+    long j = heap_hash(atom) & (set->capacity-1);
+    while (set->atoms[j] && set->atoms[j] != atom)
+        j = (j+1) & (set->capacity-1);
+    set->atoms[j] = atom;
+}
+
+static bool heap_set_contains(HeapSet *set, Atom *atom) {
+    long j = heap_hash(atom) & (set->capacity-1);
+    while (set->atoms[j]) {
+        if (set->atoms[j] == atom)
+            return true;
+        j = (j+1) & (set->capacity-1);
+    }
+    return false;
+}
+
+
+static long heap_atomlist_bytes(AtomList *lst) {
+    if (!lst)
+        return 0;
+
+    long bytes = sizeof *lst;
+    for (AtomListNode *node = lst->head; node; node = node->next)
+        bytes += sizeof *node;
+    return bytes;
+}
+
+static long heap_atom_bytes(Atom *atom) {
+    long bytes = sizeof *atom + sizeof(AtomListNode);
+
+    switch (atom->type) {
+        case atom_type_name: {
+            NameAtom *name_atom = atom->atom;
+            return bytes + sizeof *name_atom + strlen(name_atom->name)+1;
+        }
+        case atom_type_integer:
+            return bytes + sizeof(IntegerAtom);
+        case atom_type_primitive:
+            return bytes + sizeof(PrimitiveAtom);
+        case atom_type_functiondeclaration: {
+            FunctionDeclarationAtom *fd = atom->atom;
+            return bytes + sizeof *fd + heap_atomlist_bytes(fd->parameters) + heap_atomlist_bytes(fd->body)
+                + strlen(fd->source)+1 + (fd->substitutions ? heap_atomlist_bytes(fd->substitutions) : 0);
+        }
+        case atom_type_function:
+            return bytes + sizeof(FunctionAtom);
+        case atom_type_scope: {
+            ScopeAtom *scope_atom = atom->atom;
+            return bytes + sizeof *scope_atom + heap_atomlist_bytes(scope_atom->names)
+                + heap_atomlist_bytes(scope_atom->binds) + scope_atom->table_size * sizeof *scope_atom->table;
+        }
+        case atom_type_thunk:
+            return bytes + sizeof(ThunkAtom);
+        case atom_type_shared:
+            return bytes + sizeof(SharedAtom);
+        case atom_type_inline: {
+            InlineAtom *inline_atom = atom->atom;
+            return bytes + sizeof *inline_atom + heap_atomlist_bytes(inline_atom->expansion)
+                + inline_atom->guards_size * sizeof *inline_atom->guards;
+        }
+        case atom_type_unboxed:
+            return bytes + sizeof(UnboxedAtom);
+        case atom_type_structinitializer: {
+            StructInitializerAtom *si = atom->atom;
+            return bytes + sizeof *si + heap_atomlist_bytes(si->fields) + si->arity * sizeof *si->layout;
+        }
+        case atom_type_struct: {
+            StructAtom *struct_atom = atom->atom;
+            return bytes + sizeof *struct_atom + ((StructInitializerAtom *) struct_atom->shape->atom)->size * sizeof *struct_atom->slots;
+        }
+        case atom_type_string:
+            return bytes + sizeof(StringAtom) + strlen(((StringAtom *) atom->atom)->str)+1;
+        case atom_type_list:
+            return bytes + sizeof(ListAtom) + heap_atomlist_bytes(((ListAtom *) atom->atom)->list);
+        default:
+            return bytes;
+    }
+}
+
+static const char *heap_type_name(atom_type type) {
+    static const char *names[] = {
+        [atom_type_null] = "null",
+        [atom_type_nullcondition] = "nullcondition",
+        [atom_type_nullscope] = "nullscope",
+        [atom_type_Enull] = "Enull",
+        [atom_type_name] = "name",
+        [atom_type_integer] = "integer",
+        [atom_type_primitive] = "primitive",
+        [atom_type_functiondeclaration] = "functiondeclaration",
+        [atom_type_function] = "function",
+        [atom_type_scope] = "scope",
+        [atom_type_thunk] = "thunk",
+        [atom_type_shared] = "shared",
+        [atom_type_inline] = "inline",
+        [atom_type_unboxed] = "unboxed",
+        [atom_type_structinitializer] = "structinitializer",
+        [atom_type_struct] = "struct",
+        [atom_type_string] = "string",
+        [atom_type_list] = "list"
+    };
+    return names[type];
+}
+
+
+// keeps the HEAP_REPORT_TOP atoms of largest measure, in descending order
+typedef struct { Atom *atom; long measure, extra; } HeapTop;
+
+static void heap_top_insert(HeapTop *top, Atom *atom, long measure, long extra) {
+    if (measure <= top[HEAP_REPORT_TOP-1].measure)
+        return;
+
+    int j = HEAP_REPORT_TOP-1;
+    while (j > 0 && top[j-1].measure < measure) {
+        top[j] = top[j-1];
+        j--;
+    }
+    top[j] = (HeapTop) { .atom = atom, .measure = measure, .extra = extra };
+}
+
+static void heap_print_excerpt(FILE *f, const char *str, int length) {
+    for (int j = 0; j < length && str[j]; j++)
+        fputc(32 <= str[j] && str[j] < 127 ? str[j] : '.', f);
+    if ((int) strlen(str) > length)
+        fprintf(f, "...");
+}
+
+static void heap_print_names(FILE *f, AtomList *names) {
+    int j = 0;
+    for (AtomListNode *node = names->head; node; node = node->next, j++) {
+        if (j >= 8) {
+            fprintf(f, " ...");
+            break;
+        }
+        if (atom_name_is(node->atom))
+            fprintf(f, " %s", ((NameAtom *) node->atom->atom)->name);
+    }
+}
+
+
+void heap_report(FILE *f) {
+    AtomList *tables[] = { GlobalAtomTable, GlobalAtomTableMutable };
+
+    long size = 0;
+    for (int t = 0; t < 2; t++)
+        for (AtomListNode *node = tables[t]->head; node; node = node->next)
+            size++;
+
+    HeapSet live = { .capacity = 64 };
+    while (live.capacity < 2*size)
+        live.capacity *= 2;
+    live.atoms = calloc(live.capacity, sizeof *live.atoms);
+    if (!live.atoms) {
+        error("heap report :: Out of memory.\n");
+        return;
+    }
+
+    for (int t = 0; t < 2; t++)
+        for (AtomListNode *node = tables[t]->head; node; node = node->next)
+            heap_set_insert(&live, node->atom);
+
+    long counts[atom_type_list+1] = { 0 }, bytes[atom_type_list+1] = { 0 }, total = 0;
+    HeapTop strings[HEAP_REPORT_TOP] = { { 0 } }, scopes[HEAP_REPORT_TOP] = { { 0 } }, closures[HEAP_REPORT_TOP] = { { 0 } };
+    long closure_count = 0, dangling = 0;
+
+    for (int t = 0; t < 2; t++)
+        for (AtomListNode *node = tables[t]->head; node; node = node->next) {
+            Atom *atom = node->atom;
+            long b = heap_atom_bytes(atom);
+            counts[atom->type]++;
+            bytes[atom->type] += b;
+            total += b;
+
+            if (atom->type == atom_type_string)
+                heap_top_insert(strings, atom, strlen(((StringAtom *) atom->atom)->str), 0);
+
+            else if (atom->type == atom_type_scope)
+                heap_top_insert(scopes, atom, atomlist_len(((ScopeAtom *) atom->atom)->binds), b);
+
+            // the scope chain a closure keeps alive: (chain length, binds)
+            else if (atom->type == atom_type_function && ((FunctionAtom *) atom->atom)->primitive == primitive_none) {
+                closure_count++;
+
+                long length = 0, binds = 0;
+                Atom *scope = ((FunctionAtom *) atom->atom)->scope;
+                while (scope && heap_set_contains(&live, scope) && atom_scope_is(scope)) {
+                    ScopeAtom *scope_atom = scope->atom;
+                    length++;
+                    binds += atomlist_len(scope_atom->binds);
+                    scope = scope_atom->upper_scope;
+                }
+                if (scope && !heap_set_contains(&live, scope))
+                    dangling++;
+
+                heap_top_insert(closures, atom, length, binds);
+            }
+        }
+
+    fprintf(f, "=== Heap report (%ld live atoms, ~%ld bytes) ===\n", size, total);
+    fprintf(f, "%12s %14s  %s\n", "atoms", "bytes", "type");
+    for (int type = 0; type <= atom_type_list; type++)
+        if (counts[type] > 0)
+            fprintf(f, "%12ld %14ld  %s\n", counts[type], bytes[type], heap_type_name(type));
+
+    fprintf(f, "--- Largest strings ---\n");
+    for (int j = 0; j < HEAP_REPORT_TOP && strings[j].atom; j++) {
+        fprintf(f, "%12ld chars  \"", strings[j].measure);
+        heap_print_excerpt(f, ((StringAtom *) strings[j].atom->atom)->str, 60);
+        fprintf(f, "\"\n");
+    }
+
+    fprintf(f, "--- Largest scopes ---\n");
+    for (int j = 0; j < HEAP_REPORT_TOP && scopes[j].atom; j++) {
+        ScopeAtom *scope_atom = scopes[j].atom->atom;
+        fprintf(f, "%12ld binds %10ld bytes %s%s%s ", scopes[j].measure, scopes[j].extra,
+            scope_atom->is_main ? " main" : "", scope_atom->is_frozen ? " frozen" : "", scope_atom->is_selfref ? " selfref" : "");
+        heap_print_names(f, scope_atom->names);
+        fprintf(f, "\n");
+    }
+
+    fprintf(f, "--- Scope chains retained by closures (%ld closures, %ld with freed upper scopes) ---\n", closure_count, dangling);
+    for (int j = 0; j < HEAP_REPORT_TOP && closures[j].atom; j++) {
+        FunctionAtom *function_atom = closures[j].atom->atom;
+        fprintf(f, "%12ld scopes %9ld binds  ^", closures[j].measure, closures[j].extra);
+        heap_print_names(f, function_atom->parameters);
+        fprintf(f, "\n");
+    }
+
+    free(live.atoms);
+}
@@ -0,0 +1,13 @@
+#ifndef HEAPREPORT_H
+#define HEAPREPORT_H
+
+#include <stdio.h>
+#include <signal.h>
+
+
+extern volatile sig_atomic_t HeapReportRequested;
+
+void heap_report_install_signal_handler();
+void heap_report(FILE *f);
+
+#endif
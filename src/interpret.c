@@ -9,19 +9,40 @@
 #include "util.h"
 #include "memorymanagement.h"
 #include "parse.h"
+#include "profile.h"
+#include "stats.h"
+#include "trace.h"
+#include "optimize.h"
+#include "kernel.h"
+#include "parallel.h"
+#include "budget.h"
+#include "cache.h"
 
-#include "Opt.h"
-extern Opt GlobOpt;
-extern Atom *ImportedSource;
+#include "context.h"
 
 
 #define ASSERT(cnd, ...) { if (!(cnd)) return error("interpret :: " __VA_ARGS__), atom_Enull_new(); }
 static void _import_main(Atom *scope);
-static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool active);
+static Atom *_interpret(long recursion_depth, AtomListNode **pc, Atom *scope, bool active);
 
 
+/* The interpreter never mutates the atom lists it executes; it merely advances
+   a program counter `pc` over them. Top-level statements consumed from
+   `parsed` are nonetheless dropped, as callers loop until it is empty. */
 Atom *interpret_with_scope(AtomList *parsed, Atom *scope) {
-    return _interpret(0, parsed, scope, true);
+    if (!atomlist_is(parsed))
+        return error("interpret :: interpret_with_scope: Given invalid AtomList.\n"), atom_Enull_new();
+
+    AtomListNode *pc = parsed->head;
+    Atom *ret = _interpret(0, &pc, scope, true);
+
+    // a run exhausting a budget is abandoned, which consumes nothing more
+    if (GlobContext->budget.exhausted)
+        pc = NULL;
+    while (parsed->head && parsed->head != pc)
+        atomlist_pop_front(parsed);
+
+    return ret;
 }
 
 void inject_main(Atom *scope) {
@@ -33,6 +54,17 @@ void inject_main(Atom *scope) {
     interpret_with_scope(parsed, scope);
 }
 
+// a main scope shared by passes which resolve built-in names statically
+Atom *main_scope() {
+    if (!GlobContext->main_scope) {
+        Atom *scope = atom_scope_new_double_empty();
+        inject_main(scope);
+        GlobContext->main_scope = ((ScopeAtom *) scope->atom)->upper_scope;
+    }
+
+    return GlobContext->main_scope;
+}
+
 Atom *interpret(AtomList *parsed) {
     Atom *scope = atom_scope_new_double_empty();
     inject_main(scope);
@@ -41,15 +73,266 @@ Atom *interpret(AtomList *parsed) {
 }
 
 
-static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool active) {
+/* Primitive functions
+
+    Primitive functions are dispatched on their opcode. Operands which are
+    integer literals or names bound to integers are fetched in place, and a
+    primitive application in the condition position of `?` is fused with the
+    branch, such that its integer result is never boxed.
+*/
+
+static integer _primitive_modulo(integer A, integer B) { return A % B; }
+static integer _primitive_multiply(integer A, integer B) { return A * B; }
+static integer _primitive_add(integer A, integer B) { return A + B; }
+static integer _primitive_subtract(integer A, integer B) { return A - B; }
+static integer _primitive_divide(integer A, integer B) { return A / B; }
+static integer _primitive_less(integer A, integer B) { return A < B; }
+static integer _primitive_greater(integer A, integer B) { return A > B; }
+
+static integer (*const primitive_table[])(integer, integer) = {
+    [primitive_modulo] = _primitive_modulo,
+    [primitive_multiply] = _primitive_multiply,
+    [primitive_add] = _primitive_add,
+    [primitive_subtract] = _primitive_subtract,
+    [primitive_divide] = _primitive_divide,
+    [primitive_less] = _primitive_less,
+    [primitive_greater] = _primitive_greater
+};
+
+// whether a primitive function is a binary operation on integers (or `=`)
+bool primitive_integer(primitive_opcode primitive) {
+    return primitive != primitive_none && primitive <= primitive_greater;
+}
+
+// the value of an integer primitive function (without division by zero)
+integer primitive_evaluate(primitive_opcode primitive, integer A, integer B) {
+    if (primitive == primitive_equal)
+        return A == B;
+
+    return primitive_table[primitive](A, B);
+}
+
+// interpret an argument, fetching integer operands in place
+static Atom *_operand(long recursion_depth, AtomListNode **pc, Atom *scope) {
+    if (*pc && recursion_depth < GlobOpt.maximum_interpretation_recursion_depth) {
+        Atom *atom = (*pc)->atom;
+
+        if (atom->type == atom_type_name) {
+            Atom *bind = atom_scope_lookup(scope, atom);
+            if (bind && bind->type == atom_type_integer)
+                return STAT(tokens++), *pc = (*pc)->next, bind;
+        }
+        else if (atom->type == atom_type_integer)
+            return STAT(tokens++), *pc = (*pc)->next, atom;
+    }
+
+    return _interpret(recursion_depth, pc, scope, true);
+}
+
+// the opcode of the primitive function the next atom names, if any
+static primitive_opcode _peek_primitive(AtomListNode **pc, Atom *scope) {
+    if (!*pc || (*pc)->atom->type != atom_type_name)
+        return primitive_none;
+
+    Atom *bind = atom_scope_lookup(scope, (*pc)->atom);
+    if (!bind || bind->type != atom_type_function || !primitive_integer(((FunctionAtom *) bind->atom)->primitive))
+        return primitive_none;
+
+    return ((FunctionAtom *) bind->atom)->primitive;
+}
+
+#define ASSERT_OPERATE(cnd, ...) { if (!(cnd)) return error("interpret :: " __VA_ARGS__), false; }
+// apply a primitive function to the next two arguments
+static bool _operate(long recursion_depth, AtomListNode **pc, Atom *scope, primitive_opcode primitive, integer *value) {
+    STAT(primitive_applications++);
+
+    Atom *atomA = _operand(recursion_depth, pc, scope);
+    Atom *atomB = _operand(recursion_depth, pc, scope);
+
+    // atom equality
+    if (primitive == primitive_equal) {
+        ASSERT_OPERATE(atom_is(atomA), "interpret: `=` expected atom as first argument (got `%s`).\n", atom_repr(atomA))
+        ASSERT_OPERATE(atom_is(atomB), "interpret: `=` expected atom as second argument (got `%s`).\n", atom_repr(atomA))
+
+        *value = atom_equal(atomA, atomB);
+        return true;
+    }
+
+    // integer operations
+    ASSERT_OPERATE(atom_integer_is(atomA), "interpret: Integer primitive's first argument is not an integer (got `%s`).\n", atom_repr(atomA))
+    ASSERT_OPERATE(atom_integer_is(atomB), "interpret: Integer primitive's second argument is not an integer (got `%s`).\n", atom_repr(atomB))
+
+    integer A = ((IntegerAtom *) atomA->atom)->value;
+    integer B = ((IntegerAtom *) atomB->atom)->value;
+
+    if (B == 0 && (primitive == primitive_modulo || primitive == primitive_divide)) {
+        *value = 0;
+        return error("interpret :: Division by zero.\n"), true;
+    }
+
+    *value = primitive_table[primitive](A, B);
+    return true;
+}
+
+// interpret the condition of `?`
+static bool _interpret_condition(long recursion_depth, AtomListNode **pc, Atom *scope, integer *value) {
+    primitive_opcode primitive = _peek_primitive(pc, scope);
+
+    if (primitive != primitive_none && recursion_depth < GlobOpt.maximum_interpretation_recursion_depth) {
+        STAT(tokens++);
+        *pc = (*pc)->next;
+
+        if (_operate(recursion_depth+1, pc, scope, primitive, value))
+            return true;
+
+        ASSERT_OPERATE(false, "interpret: Conditional primitive expected integer as condition, got %s.\n", atom_repr(atom_Enull_new()))
+    }
+
+    Atom *condition = _interpret(recursion_depth, pc, scope, true);
+    ASSERT_OPERATE(atom_integer_is(condition), "interpret: Conditional primitive expected integer as condition, got %s.\n", atom_repr(condition))
+
+    *value = ((IntegerAtom *) condition->atom)->value;
+    return true;
+}
+#undef ASSERT_OPERATE
+
+
+/* Apply a function to arguments from C (see parallel.c). The application
+   is interpreted like the program `]f ]0 ]1 ...` in a frame binding these
+   names, passing functions and struct initializers on via `;`. */
+Atom *interpret_apply(Atom *function, Atom **arguments, int arity, long recursion_depth) {
+    AtomListNode names[arity+1], binds[arity+1], program[2*(arity+1)];
+    int size = 0;
+
+    for (int j = 0; j <= arity; j++) {
+        char name[] = { ']', j > 0 ? '0' + j-1 : 'f', '\0' };
+        Atom *bind = j > 0 ? arguments[j-1] : function;
+
+        names[j] = (AtomListNode) { .atom = atom_name_new(strdup(name)), .next = j < arity ? &names[j+1] : NULL };
+        binds[j] = (AtomListNode) { .atom = bind, .next = j < arity ? &binds[j+1] : NULL };
+
+        if (j > 0 && (atom_function_is(bind) || atom_structinitializer_is(bind)))
+            program[size++].atom = atom_primitive_new(';');
+        program[size++].atom = names[j].atom;
+    }
+    for (int j = 0; j < size; j++)
+        program[j].next = j+1 < size ? &program[j+1] : NULL;
+
+    AtomList name_list = { .head = names }, bind_list = { .head = binds };
+    ScopeAtom frame_scope = {
+        .names = &name_list,
+        .binds = &bind_list,
+        .upper_scope = atom_nullscope_new(),
+        .is_frame = true
+    };
+    Atom frame = { .type = atom_type_scope, .atom = &frame_scope };
+
+    AtomListNode *pc = program;
+    return _interpret(recursion_depth, &pc, &frame, true);
+}
+
+
+/* Shared subexpressions
+
+    A subexpression repeated within a function body, e.g. `[length]l` in
+    `-[length]l[length]l`, is preceded by a shared atom at each occurrence
+    (see optimize.c), whose value the call scope keeps in a slot once
+    the first occurrence interpreted is. Its extent was derived from the
+    arities of the names the body's closure binds when the function was
+    first applied, and of its parameters being data; a value is thus only
+    kept if interpreting the occurrence ended where its extent does, and if
+    it neither reported an error, nor exhausted a budget, nor did anything
+    import (`\`), as an import could rebind a name the body refers to. Only
+    interned values are kept, as `=` tells apart closures created anew.
+    Profiles and traces are of every application, so they keep nothing. */
+
+// imports interpreted so far
+#define Imports (GlobContext->imports)
+
+static Atom *_interpret_shared(long recursion_depth, AtomListNode **pc, Atom *scope, SharedAtom *shared_atom) {
+    SharedValue *shared = &((ScopeAtom *) scope->atom)->shared[shared_atom->slot];
+    if (shared->value && shared->imports == Imports) {
+        STAT(shared_evaluations++);
+        *pc = shared_atom->end;
+        return shared->value;
+    }
+
+    long errors = ErrorCount, imports = Imports;
+    Atom *value = _interpret(recursion_depth, pc, scope, true);
+
+    if (*pc == shared_atom->end && ErrorCount == errors && Imports == imports
+    && (value->type == atom_type_integer || value->type == atom_type_struct || value->type == atom_type_string)
+    && !GlobContext->budget.exhausted && !GlobOpt.profile && !GlobOpt.trace)
+        *shared = (SharedValue) { .value = value, .imports = imports };
+
+    return value;
+}
+
+/* An inlined application (see optimize.c) is interpreted as its expansion
+   while its guards hold; profiles and traces are of every application. */
+static bool _inline_guarded(Atom *scope, InlineAtom *inline_atom) {
+    if (GlobOpt.profile || GlobOpt.trace)
+        return false;
+
+    for (int j = 0; j < inline_atom->guards_size; j++) {
+        InlineGuard *guard = &inline_atom->guards[j];
+        Atom *bind = atom_scope_lookup(guard->scope ? guard->scope : scope, guard->name);
+
+        if (guard->bind ? bind != guard->bind
+        : !bind || bind->type == atom_type_function || bind->type == atom_type_structinitializer)
+            return false;
+    }
+
+    return true;
+}
+
+
+// advance the program counter by one atom
+static Atom *_fetch(AtomListNode **pc) {
+    if (!*pc)
+        return error("interpret :: _fetch: Program counter ran past the end.\n"), NULL;
+
+    STAT(tokens++);
+    Atom *atom = (*pc)->atom;
+    *pc = (*pc)->next;
+
+    return atom;
+}
+
+
+/* Lazy imports
+
+    Most of what a module binds are function declarations, of which an
+    importer typically uses a few. Within an import's scope, `!name^...` is
+    therefore not interpreted; the name is bound to a thunk, which creates
+    the closure when a lookup first finds it, in the import's scope or in
+    the one importing it. Creating a closure looks up no names, so it makes
+    no difference when it happens. */
+
+static Atom *_interpret(long recursion_depth, AtomListNode **pc, Atom *scope, bool active) {
     ASSERT(recursion_depth < GlobOpt.maximum_interpretation_recursion_depth,
            "interpret: Maximum interpretation iterations reached.\n")
-    ASSERT(atomlist_is(atoms), "interpret: Given invalid atoms AtomList.\n")
+    ASSERT(pc, "interpret: Given invalid program counter.\n")
     ASSERT(atom_scope_is(scope), "interpret: Given invalid scope ScopeAtom.\n")
 
+    if (GlobOpt.stats) {
+        if (recursion_depth > GlobStats.maximum_recursion_depth)
+            GlobStats.maximum_recursion_depth = recursion_depth;
+        if (StatsSnapshotRequested)
+            stats_snapshot();
+    }
+
+    // an atom produced while interpreting (an unbound name, a function's
+    // return value or a fresh closure), which is to be interpreted next
+    Atom *pending = NULL;
+
     int execution_depth = 0;
-    while (atoms->head) {
-        Atom *atom = atomlist_pop_front(atoms);
+    while (pending || *pc) {
+        if (BUDGET_STEP())
+            return atom_Enull_new();
+
+        Atom *atom = pending ? pending : _fetch(pc);
+        pending = NULL;
 
         ASSERT(atom_is(atom), "interpret: Encountered non-atom.\n")
 
@@ -58,7 +341,7 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
             ASSERT(atom_is(unbound), "interpret: Could not find name %s in scope.\n", atom_repr(atom))
 
             if (atom_function_is(unbound) || atom_structinitializer_is(unbound)) {
-                atomlist_push_front(atoms, unbound);
+                pending = unbound;
                 execution_depth++;
                 continue;
             }
@@ -68,15 +351,53 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
         }
 
 
-        if (atom_equal(atom, atom_primitive_new(','))) {
-            execution_depth++;
-            continue;
+        if (atom->type == atom_type_primitive) {
+            const char c = ((PrimitiveAtom *) atom->atom)->c;
+
+            if (c == ',') {
+                execution_depth++;
+                continue;
+            }
+            else if (c == ';') {
+                execution_depth--;
+                continue;
+            }
         }
-        else if (atom_equal(atom, atom_primitive_new(';'))) {
-            execution_depth--;
+
+
+        // see "Shared subexpressions"; inactively or within another
+        // expression, the occurrence is interpreted as is
+        if (atom->type == atom_type_shared) {
+            if (active && execution_depth == 0 && ((ScopeAtom *) scope->atom)->shared)
+                return _interpret_shared(recursion_depth, pc, scope, atom->atom);
             continue;
         }
 
+        if (atom->type == atom_type_inline) {
+            InlineAtom *inline_atom = atom->atom;
+            if (!active || execution_depth != 0 || !_inline_guarded(scope, inline_atom))
+                continue;
+
+            STAT(inlined_applications++);
+            AtomListNode *expansion_pc = inline_atom->expansion->head;
+            Atom *value = _interpret(recursion_depth, &expansion_pc, scope, true);
+            *pc = inline_atom->end;
+            return value;
+        }
+
+        // see "Unboxed subexpressions" in optimize.c
+        if (atom->type == atom_type_unboxed) {
+            UnboxedAtom *unboxed_atom = atom->atom;
+            integer value;
+            if (!active || execution_depth != 0 || GlobOpt.profile || GlobOpt.trace
+            || !kernel_apply(unboxed_atom->kernel, scope, recursion_depth, NULL, &value))
+                continue;
+
+            STAT(unboxed_evaluations++);
+            *pc = unboxed_atom->end;
+            return atom_integer_new(value);
+        }
+
 
         ASSERT(execution_depth >= 0, "Execution depth in an invalid state (%d).", execution_depth)
 
@@ -89,7 +410,6 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
             // apply function
             execution_depth--;
             FunctionAtom *function_atom = atom->atom;
-            char *p = function_atom->primitive;
 
 
             // lexical extent of inactive evaluation known, swallow arguments
@@ -97,7 +417,7 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
             // (higher-order, could else be function)
             if (execution_depth == 0 && !active) {
                 for (int j = 0; j < function_atom->arity; j++)
-                    _interpret(recursion_depth+1, atoms, atom_scope_new_fake(scope), false);
+                    _interpret(recursion_depth+1, pc, atom_scope_new_fake(scope), false);
 
                 return atom_nullcondition_new();
             }
@@ -107,69 +427,97 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
 
 
             // boxed primitive function
-            if (p) {
+            if (function_atom->primitive != primitive_none) {
                 ASSERT(execution_depth == 0, "interpret: First-order primitive called with remaining execution depth (%d).\n", execution_depth)
 
-                // atom equality
-                if (strcmp(p, "=") == 0) {
-                    Atom *atomA = _interpret(recursion_depth+1, atoms, scope, true);
-                    Atom *atomB = _interpret(recursion_depth+1, atoms, scope, true);
-
-                    ASSERT(atom_is(atomA), "interpret: `=` expected atom as first argument (got `%s`).\n", atom_repr(atomA))
-                    ASSERT(atom_is(atomB), "interpret: `=` expected atom as second argument (got `%s`).\n", atom_repr(atomA))
+                if (!primitive_integer(function_atom->primitive)) {
+                    Atom *arguments[PARALLEL_ARITY];
+                    for (int j = 0; j < function_atom->arity; j++)
+                        arguments[j] = _interpret(recursion_depth+1, pc, scope, true);
 
-                    return atom_integer_new(atom_equal(atomA, atomB));
+                    return parallel_apply(function_atom->primitive, arguments, recursion_depth+1);
                 }
 
-                // integer operations
-                else {
-                    Atom *atomA = _interpret(recursion_depth+1, atoms, scope, true);
-                    Atom *atomB = _interpret(recursion_depth+1, atoms, scope, true);
-
-                    ASSERT(atom_integer_is(atomA), "interpret: Integer primitive's first argument is not an integer (got `%s`).\n", atom_repr(atomA))
-                    ASSERT(atom_integer_is(atomB), "interpret: Integer primitive's second argument is not an integer (got `%s`).\n", atom_repr(atomB))
-
-                    integer A = ((IntegerAtom *) atomA->atom)->value;
-                    integer B = ((IntegerAtom *) atomB->atom)->value;
-
-                    if (B == 0 && (strcmp(p, "%") == 0 || strcmp(p, "/") == 0))
-                        return error("interpret :: Division by zero.\n"), atom_integer_new(0);
+                integer value;
+                if (!_operate(recursion_depth+1, pc, scope, function_atom->primitive, &value))
+                    return atom_Enull_new();
 
-                    if (p[0] != '\0' && p[1] == '\0')
-                        switch (p[0]) {
-                            #define MK(c, op) case c: return atom_integer_new(A op B);
-                            MK('%', %) MK('*', *) MK('+', +) MK('-', -) MK('/', /)
-                            MK('<', <) MK('=', ==) MK('>', >)
-                            #undef MK
-
-                            default: ASSERT(false, "interpret: Unknown primitive `%s`.\n", atom_repr(atom))
-                        }
-
-                    else
-                        ASSERT(false, "interpret: Unknown primitive `%s`.\n", atom_repr(atom))
-                }
+                return atom_integer_new(value);
             }
 
             // non-primitive function
             else {
+                FunctionDeclarationAtom *fd = function_atom->declaration;
+                ASSERT(!fd->lazy || parse_body(fd), "interpret: Could not parse function body.\n")
+                if (fd->shared < 0)
+                    optimize_applied(fd, function_atom->scope);
+
+                /* A call scope which cannot outlive the call is a frame on the
+                   C stack; its names are the function's parameters. */
+                int arity = fd->inline_frame ? function_atom->arity : 0;
+                AtomListNode frame_binds[arity > 0 ? arity : 1];
+                AtomList frame_bind_list = { .head = arity > 0 ? frame_binds : NULL };
+                ScopeAtom frame_scope = {
+                    .names = function_atom->parameters,
+                    .binds = &frame_bind_list,
+                    .upper_scope = function_atom->scope,
+                    .is_frame = true
+                };
+                Atom frame = { .type = atom_type_scope, .atom = &frame_scope };
+
+                Atom *arguments[KERNEL_ARITY];
+
                 // bind parameters
                 AtomListNode *node = function_atom->parameters->head;
-                Atom *scp = atom_scope_new_inherits(function_atom->scope);
-                while (node) {
-                    Atom *a = _interpret(recursion_depth+1, atoms, scope, true);
+                Atom *scp = fd->inline_frame ? &frame : atom_scope_new_inherits(function_atom->scope);
+                for (int j = 0; node; j++) {
+                    Atom *a = _interpret(recursion_depth+1, pc, scope, true);
 
                     ASSERT(atom_is(a), "interpret: Found no atom to bind function parameter %s to.\n", atom_repr(node->atom))
-                    ASSERT(atom_scope_push(scp, node->atom, a), "interpret: Attempt at rebind.\n")
+                    if (fd->inline_frame)
+                        frame_binds[j] = (AtomListNode) { .atom = a, .next = j+1 < arity ? &frame_binds[j+1] : NULL };
+                    else
+                        ASSERT(atom_scope_push(scp, node->atom, a), "interpret: Attempt at rebind.\n")
+                    if (j < KERNEL_ARITY)
+                        arguments[j] = a;
 
                     node = node->next;
                 }
 
-                AtomList *atoms_copy = atomlist_copy(function_atom->body);
-                Atom *ret = _interpret(recursion_depth+1, atoms_copy, scp, true);
-                atomlist_free(atoms_copy);
+                Atom *ret;
+                integer value;
+
+                // profiles and traces are of interpreted applications
+                if (fd->kernel && !GlobOpt.profile && !GlobOpt.trace
+                && kernel_apply(fd->kernel, function_atom->scope, recursion_depth+1, arguments, &value)) {
+                    STAT(user_applications++);
+                    ret = atom_integer_new(value);
+                }
+
+                else {
+                    STAT(user_applications++);
+                    if (GlobOpt.profile)
+                        profile_enter(function_atom->body);
+                    double trace_start = GlobOpt.trace ? trace_begin_sampled() : -1;
+
+                    SharedValue shared[fd->shared > 0 ? fd->shared : 1];
+                    for (int j = 0; j < fd->shared; j++)
+                        shared[j] = (SharedValue) { .value = NULL, .imports = 0 };
+                    ((ScopeAtom *) scp->atom)->shared = fd->shared > 0 ? shared : NULL;
+
+                    AtomListNode *body_pc = function_atom->body->head;
+                    ret = _interpret(recursion_depth+1, &body_pc, scp, true);
+
+                    ((ScopeAtom *) scp->atom)->shared = NULL;
+
+                    if (GlobOpt.trace)
+                        trace_span("function", NULL, function_atom->body, 0, trace_start);
+                    if (GlobOpt.profile)
+                        profile_exit();
+                }
 
                 if (execution_depth > 0)
-                    atomlist_push_front(atoms, ret);
+                    pending = ret;
                 else
                     return active ? ret : atom_nullcondition_new();
             }
@@ -188,49 +536,50 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
             ASSERT(execution_depth == 0, "Unexpected execution depth in struct initializer (%d).\n", execution_depth)
 
             if (execution_depth == 0 && !active) {
-                for (int j = 0; j < atomlist_len(structinitializer_atom->fields); j++)
-                    _interpret(recursion_depth+1, atoms, atom_scope_new_fake(scope), false);
+                for (int j = 0; j < structinitializer_atom->arity; j++)
+                    _interpret(recursion_depth+1, pc, atom_scope_new_fake(scope), false);
 
                 return atom_nullcondition_new();
             }
 
-            Atom *type = structinitializer_atom->type;
-            AtomList *fields = structinitializer_atom->fields;
-            Atom *struct_scope = atom_scope_new_empty();
-            AtomListNode *node = fields->head;
+            STAT(struct_initializations++);
+            int size = structinitializer_atom->size;
+            Atom **slots = size > 0 ? mm_malloc("interpret: slots", size * sizeof *slots) : NULL;
+
+            if (structinitializer_atom->arity == size)
+                for (int j = 0; j < size; j++)
+                    slots[j] = _interpret(recursion_depth+1, pc, scope, true);
 
-            while (node) {
-                atom_scope_push(struct_scope, node->atom, _interpret(recursion_depth+1, atoms, scope, true));
-                node = node->next;
+            // a repeated field keeps its first value, as a rebind would
+            else {
+                for (int j = 0; j < size; j++)
+                    slots[j] = NULL;
+
+                for (AtomListNode *field = structinitializer_atom->fields->head; field; field = field->next) {
+                    Atom *value = _interpret(recursion_depth+1, pc, scope, true);
+                    int slot = atom_structinitializer_slot(atom, field->atom);
+                    if (!slots[slot])
+                        slots[slot] = value;
+                    else
+                        error("interpret: Attempt at struct field rebinding (%s already bound as %s).\n",
+                            atom_repr(field->atom), atom_repr(slots[slot]));
+                }
             }
 
-            return atom_struct_new(type, atom_scope_freeze(struct_scope));
+            return atom_struct_new(atom, slots);
         }
 
 
         // set up lexical scoping and turn function declaration into function
         else if (atom_functiondeclaration_is(atom)) {
-            FunctionDeclarationAtom *fd = atom->atom;
-            Atom *scp = atom_scope_new_inherits(scope);
-            Atom *f_scp = atom_scope_new_inherits(scp);
-            Atom *f = atom_function_new(
-                fd->arity,
-                atomlist_copy(fd->parameters),
-                atomlist_copy(fd->body),
-                f_scp,
-                NULL // not primitive
-            );
-
-            // self-referring name
-            atom_scope_push(scp, atom_name_new(strdup("@")), f);
-            atom_scope_setflag_isselfref(scp, true);
+            Atom *f = atom_closure_new(atom, scope);
 
             ASSERT(execution_depth >= 0, "interpret: Execution depth negative when encountering function declaration.\n")
 
             if (execution_depth == 0)
                 return active ? f : atom_nullcondition_new();
 
-            atomlist_push_front(atoms, f);
+            pending = f;
             continue;
         }
 
@@ -246,35 +595,49 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
 
 
             if (c == '!') {
-                Atom *name = atomlist_pop_front(atoms);
+                Atom *name = _fetch(pc);
                 ASSERT(atom_name_is(name), "interpret: Bind needs NameAtom, got %s.\n", atom_repr(name))
 
-                Atom *bind = _interpret(recursion_depth+1, atoms, scope, active);
+                // see "Lazy imports"
+                if (active && ((ScopeAtom *) scope->atom)->is_import && *pc && atom_functiondeclaration_is((*pc)->atom)) {
+                    Atom *declaration = _fetch(pc);
+                    ASSERT(atom_scope_push(scope, name, atom_thunk_new(declaration, scope)), "interpret: Could not bind %s.\n", atom_repr(name))
+
+                    if (GlobOpt.profile || GlobOpt.trace)
+                        profile_name(((FunctionDeclarationAtom *) declaration->atom)->body, name);
+                    continue;
+                }
+
+                Atom *bind = _interpret(recursion_depth+1, pc, scope, active);
                 ASSERT(atom_is(bind), "interpret: Bind needs Atom, got %s.\n", atom_repr(bind))
 
                 ASSERT(atom_scope_push(scope, name, bind), "interpret: Could not bind %s.\n", atom_repr(name))
+
+                if ((GlobOpt.profile || GlobOpt.trace) && atom_function_is(bind) && ((FunctionAtom *) bind->atom)->primitive == primitive_none)
+                    profile_name(((FunctionAtom *) bind->atom)->body, name);
                 continue;
             }
 
             else if (c == '?') {
                 if (!active) {
                     for (int j = 0; j < 3; j++)
-                        ASSERT(atom_nullcondition_is(_interpret(recursion_depth+1, atoms, scope, false)), "interpret: Conditional primitive expected three arguments, got too few.\n")
+                        ASSERT(atom_nullcondition_is(_interpret(recursion_depth+1, pc, scope, false)), "interpret: Conditional primitive expected three arguments, got too few.\n")
 
                     return atom_nullcondition_new();
                 }
 
-                Atom *condition = _interpret(recursion_depth+1, atoms, scope, true);
-                ASSERT(atom_integer_is(condition), "interpret: Conditional primitive expected integer as condition, got %s.\n", atom_repr(condition))
+                integer condition;
+                if (!_interpret_condition(recursion_depth+1, pc, scope, &condition))
+                    return atom_Enull_new();
 
                 Atom *return_;
-                if (((IntegerAtom *) condition->atom)->value) {
-                    return_ = _interpret(recursion_depth+1, atoms, scope, true);
-                    _interpret(recursion_depth+1, atoms, scope, false);
+                if (condition) {
+                    return_ = _interpret(recursion_depth+1, pc, scope, true);
+                    _interpret(recursion_depth+1, pc, scope, false);
                 }
                 else {
-                    _interpret(recursion_depth+1, atoms, scope, false);
-                    return_ = _interpret(recursion_depth+1, atoms, scope, true);
+                    _interpret(recursion_depth+1, pc, scope, false);
+                    return_ = _interpret(recursion_depth+1, pc, scope, true);
                 }
 
                 return active ? return_ : atom_nullcondition_new();
@@ -283,78 +646,75 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
             else if (c == '|') {
                 if (!active) {
                     for (int j = 0; j < 2; j++)
-                        ASSERT(atom_nullcondition_is(_interpret(recursion_depth+1, atoms, scope, false)), "interpret: Choosing or expected three arguments, got too few.\n")
+                        ASSERT(atom_nullcondition_is(_interpret(recursion_depth+1, pc, scope, false)), "interpret: Choosing or expected three arguments, got too few.\n")
 
                     return atom_nullcondition_new();
                 }
 
-                Atom *first = _interpret(recursion_depth+1, atoms, scope, true);
+                Atom *first = _interpret(recursion_depth+1, pc, scope, true);
                 ASSERT(atom_integer_is(first), "interpret: Choosing or expected integer as first atom, got %s.\n", atom_repr(first))
 
                 if (((IntegerAtom *) first->atom)->value) {
-                    _interpret(recursion_depth+1, atoms, scope, false);
+                    _interpret(recursion_depth+1, pc, scope, false);
                     return active ? first : atom_nullcondition_new();
                 }
 
-                Atom *second = _interpret(recursion_depth+1, atoms, scope, true);
+                Atom *second = _interpret(recursion_depth+1, pc, scope, true);
                 return active ? second : atom_nullcondition_new();
             }
 
             else if (c == '&') {
                 if (!active) {
                     for (int j = 0; j < 2; j++)
-                        ASSERT(atom_nullcondition_is(_interpret(recursion_depth+1, atoms, scope, false)), "interpret: Choosing and expected three arguments, got too few.\n")
+                        ASSERT(atom_nullcondition_is(_interpret(recursion_depth+1, pc, scope, false)), "interpret: Choosing and expected three arguments, got too few.\n")
 
                     return atom_nullcondition_new();
                 }
 
-                Atom *first = _interpret(recursion_depth+1, atoms, scope, true);
+                Atom *first = _interpret(recursion_depth+1, pc, scope, true);
                 ASSERT(atom_integer_is(first), "interpret: Choosing and expected integer as first atom, got %s.\n", atom_repr(first))
 
                 if (((IntegerAtom *) first->atom)->value) {
-                    Atom *second = _interpret(recursion_depth+1, atoms, scope, true);
+                    Atom *second = _interpret(recursion_depth+1, pc, scope, true);
                     return active ? second : atom_nullcondition_new();
                 }
 
-                _interpret(recursion_depth+1, atoms, scope, false);
+                _interpret(recursion_depth+1, pc, scope, false);
                 return active ? first : atom_nullcondition_new();
             }
 
             // struct type check
             else if (c == '#' + '?' /* == 'b' */) {
                 if (!active) {
-                    atomlist_pop_front(atoms);
-                    _interpret(recursion_depth+1, atoms, scope, false);
+                    _fetch(pc);
+                    _interpret(recursion_depth+1, pc, scope, false);
                     return atom_nullcondition_new();
                 }
 
-                Atom *type = atomlist_pop_front(atoms);
+                Atom *type = _fetch(pc);
                 ASSERT(atom_name_is(type), "interpret: Struct type check requires NameAtom, got %s.\n", atom_repr(type))
 
-                Atom *struct_ = _interpret(recursion_depth+1, atoms, scope, active);
+                Atom *struct_ = _interpret(recursion_depth+1, pc, scope, active);
                 ASSERT(atom_struct_is(struct_), "interpret: Struct type check requires StructAtom, got %s.\n", atom_repr(struct_))
 
-                StructAtom *struct_atom = struct_->atom;
-
-                return atom_integer_new(atom_equal(struct_atom->type, type));
+                return atom_integer_new(atom_equal(atom_struct_type(struct_), type));
             }
 
             // struct field extraction
             else if (c == '#' + '!' /* == 'D' */) {
                 if (!active) {
-                    atomlist_pop_front(atoms);
-                    _interpret(recursion_depth+1, atoms, atom_scope_new_fake(scope), false);
+                    _fetch(pc);
+                    _interpret(recursion_depth+1, pc, atom_scope_new_fake(scope), false);
                     return atom_nullcondition_new();
                 }
 
-                Atom *field_name = atomlist_pop_front(atoms);
+                Atom *field_name = _fetch(pc);
                 ASSERT(atom_name_is(field_name), "interpret: Struct field extraction requires NameAtom, got %s.\n", atom_repr(field_name))
 
-                Atom *struct_ = _interpret(recursion_depth+1, atoms, scope, active);
+                Atom *struct_ = _interpret(recursion_depth+1, pc, scope, active);
                 ASSERT(atom_struct_is(struct_), "interpret: Struct field extraction requires StructAtom, got %s.\n", atom_repr(struct_))
 
-                StructAtom *struct_atom = struct_->atom;
-                Atom *extracted = atom_scope_unbind(struct_atom->scope, field_name);
+                Atom *extracted = atom_struct_field(struct_, field_name);
                 ASSERT(extracted, "interpret: Could not extract field name %s from struct %s.\n", atom_repr(field_name), atom_repr(struct_))
 
                 return extracted;
@@ -362,12 +722,13 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
 
             // import
             else if (c == '\\') {
+                Imports++;
                 Atom *upper_scope = ((ScopeAtom *) scope->atom)->upper_scope;
                 ASSERT(!atom_nullscope_is(upper_scope), "interpret: Importing into one-layered scope.\n")
 
 
                 // loading import source
-                Atom *import_name = atomlist_pop_front(atoms);
+                Atom *import_name = _fetch(pc);
                 ASSERT(atom_name_is(import_name), "interpret: Import needs NameAtom, got %s.\n", atom_repr(import_name))
 
                 if (atom_equal(import_name, atom_name_new(strdup("]M")))) {
@@ -377,6 +738,8 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
                 }
 
                 info("Importing '%s':\n", atom_repr(import_name));
+                STAT(imports++);
+                double trace_start = GlobOpt.trace ? trace_begin() : -1;
                 if (!atom_scope_contains_bind(ImportedSource, import_name)) {
                     Atom *import_contents = atom_string_read_from_file(string_from_atom(import_name));
                     ASSERT(atom_string_is(import_contents), "interpret: Import failed.\n")
@@ -388,13 +751,17 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
 
 
                 // interpreting import source
-                AtomList *import_parsed = parse(import_source);
+                double trace_parse_start = GlobOpt.trace ? trace_begin() : -1;
+                AtomList *import_parsed = cache_parse(import_source);
+                if (GlobOpt.trace)
+                    trace_span("parse", ((NameAtom *) import_name->atom)->name, NULL, 0, trace_parse_start);
                 ASSERT(import_parsed != NULL, "interpret: Could not parse import source.:\n")
                 atomlist_push(import_parsed, atom_primitive_new('S'));
 
                 Atom *import_scope = atom_scope_new_double_empty();
                 inject_main(import_scope);
                 Atom *imported_scope = NULL;
+                ((ScopeAtom *) import_scope->atom)->is_import = true;
                 while (!atomlist_empty(import_parsed))
                     imported_scope = interpret_with_scope(import_parsed, import_scope);
                 ASSERT(atom_scope_is(imported_scope), "interpret: Did not import a scope.\n")
@@ -405,12 +772,14 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
                 while (name_node) {
                     Atom *name = name_node->atom;
                     if (!atom_scope_contains_bind(upper_scope, name)) {
-                        atom_scope_push(upper_scope, name, atom_scope_unbind(import_scope, name));
+                        atom_scope_push(upper_scope, name, atom_scope_lookup_local(import_scope, name));
                         info("    Bound '%s'.\n", atom_repr(name));
                     }
                     name_node = name_node->next;
                 }
 
+                if (GlobOpt.trace)
+                    trace_span("import", ((NameAtom *) import_name->atom)->name, NULL, 0, trace_start);
                 continue;
             }
 
@@ -423,9 +792,10 @@ static Atom *_interpret(long recursion_depth, AtomList *atoms, Atom *scope, bool
             continue;
         }
 
+        // like names bound to integers, literals are silent when inactive
         if (atom_integer_is(atom)) {
             ASSERT(execution_depth == 0, "Integer used with non-zero execution depth.\n")
-            return atom;
+            return active ? atom : atom_nullcondition_new();
         }
 
         if (atom_structinitializer_is(atom) || atom_struct_is(atom))
@@ -449,17 +819,24 @@ static void _import_main(Atom *scope) {
     BD("5", 5) BD("6", 6) BD("7", 7) BD("8", 8) BD("9", 9)
 
     // bind arithmetic primitive macro
-    #define BAP(str) B(strdup(str), atom_function_new(2, NULL, NULL, atom_nullscope_new(), strdup(str)))
-    // #define BAP3(str) B(strdup(str), atom_function_new(3, NULL, NULL, atom_nullscope_new(), strdup(str)))
+    #define BAP(str, op) B(strdup(str), atom_function_new(2, NULL, NULL, atom_nullscope_new(), op))
+    // #define BAP3(str, op) B(strdup(str), atom_function_new(3, NULL, NULL, atom_nullscope_new(), op))
 
-    BAP("%") BAP("*") BAP("+") BAP("-") BAP("/") BAP("<") BAP("=") BAP(">")
+    BAP("%", primitive_modulo) BAP("*", primitive_multiply) BAP("+", primitive_add)
+    BAP("-", primitive_subtract) BAP("/", primitive_divide) BAP("<", primitive_less)
+    BAP("=", primitive_equal) BAP(">", primitive_greater)
     // BAP("!") BAP3("?") BAP("|") BAP("&")
 
+    // bind higher-order primitive macro
+    #define BHP(str, arity, op) B(strdup(str), atom_function_new(arity, NULL, NULL, atom_nullscope_new(), op))
+    BHP("pmap", 2, primitive_pmap) BHP("pfilter", 2, primitive_pfilter) BHP("preduce", 3, primitive_preduce)
+
     #undef BD
     #undef B
 
     #undef BAP
     #undef BAP3
+    #undef BHP
 
     ((ScopeAtom *) scope->atom)->is_main = true;
 }
@@ -8,6 +8,12 @@
 Atom *interpret(AtomList *parsed);
 Atom *interpret_with_scope(AtomList *parsed, Atom *scope);
 void inject_main(Atom *scope);
+Atom *main_scope();
+
+bool primitive_integer(primitive_opcode primitive);
+integer primitive_evaluate(primitive_opcode primitive, integer A, integer B);
+
+Atom *interpret_apply(Atom *function, Atom **arguments, int arity, long recursion_depth);
 
 
 #endif
@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "jit.h"
+#include "kernel.h"
+#include "memorymanagement.h"
+#include "budget.h"
+#include "debug.h"
+
+#include "context.h"
+
+
+/* Just-in-time compilation of integer kernels (x86-64)
+
+    Once a kernel has been applied `JIT_THRESHOLD` times, its body is
+    translated node by node into x86-64 code operating on unboxed 64-bit
+    integers. The generated function is a `KernelNative`: it takes the
+    interpretation depth in rdi and its arguments (followed by the captured
+    names' values) in rsi. rbx and r12 hold both for the body, whose values
+    are computed into rax. Recursive calls build their arguments on the
+    stack, which is kept aligned at calls. Where the interpreter would report
+    an error the code jumps to a stub calling `kernel_bail`, upon which the
+    application is interpreted. Each call counts a step against the run's
+    budget (see budget.c). The interpreter guards natives against
+    non-integer arguments (see `kernel_apply`); `--nojit` disables the JIT.
+    On other architectures, no kernel is compiled. */
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+
+typedef struct {
+    unsigned char *code;
+    long size, capacity;
+    long slots;
+    long *bails;
+    long bails_size, bails_capacity;
+} Jit;
+
+
+static void jit_byte(Jit *j, unsigned char byte) {
+    if (j->size >= j->capacity) {
+        long capacity = 2 * j->capacity;
+        unsigned char *code = mm_malloc("jit: code", capacity);
+        memcpy(code, j->code, j->size);
+        mm_free("jit: code", j->code);
+        j->code = code;
+        j->capacity = capacity;
+    }
+
+    j->code[j->size++] = byte;
+}
+
+static void jit_bytes(Jit *j, const char *bytes, int n) {
+    for (int k = 0; k < n; k++)
+        jit_byte(j, (unsigned char) bytes[k]);
+}
+
+static void jit_int32(Jit *j, long value) {
+    for (int k = 0; k < 4; k++)
+        jit_byte(j, (unsigned char) ((unsigned long) value >> 8*k));
+}
+
+static void jit_int64(Jit *j, unsigned long value) {
+    for (int k = 0; k < 8; k++)
+        jit_byte(j, (unsigned char) (value >> 8*k));
+}
+
+// emit a jump with a 32-bit displacement, returning where to patch it
+static long jit_jump(Jit *j, const char *opcode, int n) {
+    jit_bytes(j, opcode, n);
+    long at = j->size;
+    jit_int32(j, 0);
+    return at;
+}
+
+static void jit_patch(Jit *j, long at, long target) {
+    long displacement = target - (at + 4);
+    for (int k = 0; k < 4; k++)
+        j->code[at+k] = (unsigned char) ((unsigned long) displacement >> 8*k);
+}
+
+static void jit_bail(Jit *j, const char *opcode, int n) {
+    if (j->bails_size >= j->bails_capacity) {
+        long capacity = j->bails_capacity > 0 ? 2 * j->bails_capacity : 16;
+        long *bails = mm_malloc("jit: bails", capacity * sizeof *bails);
+        for (long k = 0; k < j->bails_size; k++)
+            bails[k] = j->bails[k];
+        if (j->bails)
+            mm_free("jit: bails", j->bails);
+        j->bails = bails;
+        j->bails_capacity = capacity;
+    }
+
+    j->bails[j->bails_size++] = jit_jump(j, opcode, n);
+}
+
+#define JZ "\x0F\x84", 2
+#define JNZ "\x0F\x85", 2
+#define JGE "\x0F\x8D", 2
+#define JNS "\x0F\x89", 2
+#define JMP "\xE9", 1
+
+
+// load a constant, parameter or captured name into rax (register 0) or rcx (1)
+static bool jit_leaf(Jit *j, Kernel *kernel, KernelNode *node, int reg) {
+    if (node->operation == kernel_constant) {
+        jit_bytes(j, reg ? "\x48\xB9" : "\x48\xB8", 2);             // mov r, imm64
+        jit_int64(j, (unsigned long) node->value);
+        return true;
+    }
+
+    if (node->operation == kernel_parameter || node->operation == kernel_captured) {
+        long index = node->value + (node->operation == kernel_captured ? kernel->arity : 0);
+        jit_bytes(j, reg ? "\x49\x8B\x8C\x24" : "\x49\x8B\x84\x24", 4); // mov r, [r12 + disp32]
+        jit_int32(j, 8 * index);
+        return true;
+    }
+
+    return false;
+}
+
+static void jit_node(Jit *j, Kernel *kernel, KernelNode *node) {
+    if (jit_leaf(j, kernel, node, 0))
+        return;
+
+    long at, end;
+    switch (node->operation) {
+        case kernel_primitive:
+            jit_node(j, kernel, node->operands[0]);
+            if (!jit_leaf(j, kernel, node->operands[1], 1)) {
+                jit_byte(j, 0x50);                                  // push rax
+                j->slots++;
+                jit_node(j, kernel, node->operands[1]);
+                jit_bytes(j, "\x48\x89\xC1", 3);                    // mov rcx, rax
+                jit_byte(j, 0x58);                                  // pop rax
+                j->slots--;
+            }
+
+            switch (node->primitive) {
+                case primitive_add: jit_bytes(j, "\x48\x01\xC8", 3); break;          // add rax, rcx
+                case primitive_subtract: jit_bytes(j, "\x48\x29\xC8", 3); break;     // sub rax, rcx
+                case primitive_multiply: jit_bytes(j, "\x48\x0F\xAF\xC1", 4); break; // imul rax, rcx
+
+                case primitive_divide:
+                case primitive_modulo:
+                    jit_bytes(j, "\x48\x85\xC9", 3);                // test rcx, rcx
+                    jit_bail(j, JZ);
+                    jit_bytes(j, "\x48\x83\xF9\xFF", 4);            // cmp rcx, -1
+                    at = jit_jump(j, JNZ);
+                    jit_bytes(j, "\x48\xBA", 2);                    // mov rdx, LONG_MIN
+                    jit_int64(j, (unsigned long) LONG_MIN);
+                    jit_bytes(j, "\x48\x39\xD0", 3);                // cmp rax, rdx
+                    jit_bail(j, JZ);
+                    jit_patch(j, at, j->size);
+
+                    jit_bytes(j, "\x48\x99\x48\xF7\xF9", 5);        // cqo; idiv rcx
+                    if (node->primitive == primitive_modulo)
+                        jit_bytes(j, "\x48\x89\xD0", 3);            // mov rax, rdx
+                    break;
+
+                case primitive_less:
+                case primitive_equal:
+                case primitive_greater:
+                    jit_bytes(j, "\x48\x39\xC8", 3);                // cmp rax, rcx
+                    jit_bytes(j, node->primitive == primitive_less ? "\x0F\x9C\xC0"
+                        : node->primitive == primitive_equal ? "\x0F\x94\xC0" : "\x0F\x9F\xC0", 3); // setcc al
+                    jit_bytes(j, "\x0F\xB6\xC0", 3);                // movzx eax, al
+                    break;
+
+                default:
+                    break;
+            }
+            break;
+
+        case kernel_conditional:
+            jit_node(j, kernel, node->operands[0]);
+            jit_bytes(j, "\x48\x85\xC0", 3);                        // test rax, rax
+            at = jit_jump(j, JZ);
+            jit_node(j, kernel, node->operands[1]);
+            end = jit_jump(j, JMP);
+            jit_patch(j, at, j->size);
+            jit_node(j, kernel, node->operands[2]);
+            jit_patch(j, end, j->size);
+            break;
+
+        // `|` chooses a non-zero first argument, `&` a zero one
+        case kernel_or:
+        case kernel_and:
+            jit_node(j, kernel, node->operands[0]);
+            jit_bytes(j, "\x48\x85\xC0", 3);                        // test rax, rax
+            end = node->operation == kernel_or ? jit_jump(j, JNZ) : jit_jump(j, JZ);
+            jit_node(j, kernel, node->operands[1]);
+            jit_patch(j, end, j->size);
+            break;
+
+        case kernel_recurse: {
+            long size = kernel->arity + kernel->captures_size;
+            long slots = size + (j->slots + size) % 2;
+
+            jit_bytes(j, "\x48\x81\xEC", 3);                        // sub rsp, imm32
+            jit_int32(j, 8 * slots);
+            j->slots += slots;
+
+            for (int k = 0; k < node->size; k++) {
+                jit_node(j, kernel, node->operands[k]);
+                jit_bytes(j, "\x48\x89\x84\x24", 4);                // mov [rsp + disp32], rax
+                jit_int32(j, 8 * k);
+            }
+            for (int k = 0; k < kernel->captures_size; k++) {
+                jit_bytes(j, "\x49\x8B\x84\x24", 4);                // mov rax, [r12 + disp32]
+                jit_int32(j, 8 * (kernel->arity + k));
+                jit_bytes(j, "\x48\x89\x84\x24", 4);                // mov [rsp + disp32], rax
+                jit_int32(j, 8 * (kernel->arity + k));
+            }
+
+            // the called body is interpreted one level deeper than `@`
+            jit_bytes(j, "\x48\x8D\xBB", 3);                        // lea rdi, [rbx + disp32]
+            jit_int32(j, node->depth + 1);
+            jit_bytes(j, "\x48\x89\xE6", 3);                        // mov rsi, rsp
+            jit_patch(j, jit_jump(j, "\xE8", 1), 0);                // call body
+
+            jit_bytes(j, "\x48\x81\xC4", 3);                        // add rsp, imm32
+            jit_int32(j, 8 * slots);
+            j->slots -= slots;
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+KernelNative jit_compile(Kernel *kernel) {
+    Jit j = {
+        .code = mm_malloc("jit: code", 256),
+        .size = 0,
+        .capacity = 256,
+        .slots = 0,
+        .bails = NULL,
+        .bails_size = 0,
+        .bails_capacity = 0
+    };
+
+    jit_bytes(&j, "\x55\x48\x89\xE5\x53\x41\x54", 7);              // push rbp; mov rbp, rsp; push rbx; push r12
+    jit_bytes(&j, "\x48\x89\xFB\x49\x89\xF4", 6);                  // mov rbx, rdi; mov r12, rsi
+
+    jit_bytes(&j, "\x48\x8D\x83", 3);                               // lea rax, [rbx + disp32]
+    jit_int32(&j, kernel->depth + 1);
+    jit_bytes(&j, "\x48\xB9", 2);                                   // mov rcx, imm64
+    jit_int64(&j, (unsigned long) &GlobOpt.maximum_interpretation_recursion_depth);
+    jit_bytes(&j, "\x48\x3B\x01", 3);                               // cmp rax, [rcx]
+    jit_bail(&j, JGE);
+
+    // BUDGET_STEP(), the stack being aligned after the pushes
+    jit_bytes(&j, "\x48\xB8", 2);                                   // mov rax, imm64
+    jit_int64(&j, (unsigned long) &GlobContext->budget.countdown);
+    jit_bytes(&j, "\x48\xFF\x08", 3);                               // dec qword [rax]
+    long counted = jit_jump(&j, JNS);
+    jit_bytes(&j, "\x48\xB8", 2);                                   // mov rax, imm64
+    jit_int64(&j, (unsigned long) budget_tick);
+    jit_bytes(&j, "\xFF\xD0\x84\xC0", 4);                           // call rax; test al, al
+    jit_bail(&j, JNZ);
+    jit_patch(&j, counted, j.size);
+
+    jit_node(&j, kernel, kernel->body);
+    jit_bytes(&j, "\x41\x5C\x5B\x5D\xC3", 5);                      // pop r12; pop rbx; pop rbp; ret
+
+    long stub = j.size;
+    jit_bytes(&j, "\x48\x83\xE4\xF0\x48\xB8", 6);                  // and rsp, -16; mov rax, imm64
+    jit_int64(&j, (unsigned long) kernel_bail);
+    jit_bytes(&j, "\xFF\xD0", 2);                                   // call rax
+    for (long k = 0; k < j.bails_size; k++)
+        jit_patch(&j, j.bails[k], stub);
+
+    void *code = mmap(NULL, j.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code != MAP_FAILED) {
+        memcpy(code, j.code, j.size);
+        if (mprotect(code, j.size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(code, j.size);
+            code = MAP_FAILED;
+        }
+    }
+
+    mm_free("jit: code", j.code);
+    if (j.bails)
+        mm_free("jit: bails", j.bails);
+
+    if (code == MAP_FAILED) {
+        warning("jit :: Could not map executable memory.\n");
+        return NULL;
+    }
+
+    kernel->code = code;
+    kernel->code_size = j.size;
+
+    KernelNative native;
+    memcpy(&native, &code, sizeof native);
+    return native;
+}
+
+void jit_free(Kernel *kernel) {
+    if (kernel->code)
+        munmap(kernel->code, kernel->code_size);
+    kernel->code = NULL;
+}
+
+#else
+
+KernelNative jit_compile(Kernel *kernel) {
+    return NULL;
+}
+
+void jit_free(Kernel *kernel) {
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "kernel.h"
+
+
+// kernel applications interpreted before a kernel is compiled
+#define JIT_THRESHOLD 16
+
+KernelNative jit_compile(Kernel *kernel);
+void jit_free(Kernel *kernel);
+
+#endif
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <limits.h>
+
+#include "kernel.h"
+#include "jit.h"
+#include "atom.h"
+#include "atomlist.h"
+#include "interpret.h"
+#include "memorymanagement.h"
+#include "debug.h"
+#include "util.h"
+#include "budget.h"
+
+#include "context.h"
+
+
+/* Integer kernels
+
+    A function declaration whose body is a single expression built from
+    integer literals, its parameters, names bound to integers in its scope,
+    the main scope's integer primitives and digits, `?`, `|`, `&` and calls
+    of `@` is an integer kernel: applied to integers, all its intermediate
+    values are integers, which need not be boxed. Kernels are compiled to a
+    tree of `KernelNode`s when a program is optimized; natives generated
+    from them, ahead of time (see `--emit-c`) or just in time (see jit.c),
+    are called by the interpreter instead of interpreting the body. Until
+    a kernel has a native, its tree is evaluated on unboxed integers.
+
+    Whether a function is a kernel is decided for its body as a whole. In
+    a function mixing integers with other values (taking a struct or a
+    list, binding names, calling functions other than itself, or having
+    several statements), the integer expressions are compiled to kernels
+    of no parameters once it is first applied (see "Unboxed
+    subexpressions" in optimize.c); the rest of it is interpreted on boxed
+    atoms, as is a kernel applied to arguments that are not all integers.
+
+    A native bails out (`kernel_bail`) whenever the interpreter would report
+    an error, i.e. on division by zero and where it would exceed the
+    maximum interpretation depth, and once a budget is exhausted (each body
+    evaluated counts as a step); as kernels are pure, the application is
+    then simply interpreted. */
+
+static const KernelEntry *Natives = NULL;
+static long NativesSize = 0;
+#define Bail (GlobContext->bail)
+
+
+static KernelNode *kernel_node_new(kernel_operation operation, int size, int depth) {
+    KernelNode *node = mm_malloc("kernel: node", sizeof *node);
+    node->operation = operation;
+    node->primitive = primitive_none;
+    node->value = 0;
+    node->depth = depth;
+    node->size = size;
+    node->operands = NULL;
+
+    if (size > 0) {
+        node->operands = mm_malloc("kernel: operands", size * sizeof *node->operands);
+        for (int j = 0; j < size; j++)
+            node->operands[j] = NULL;
+    }
+
+    return node;
+}
+
+static void kernel_node_free(KernelNode *node) {
+    if (!node)
+        return;
+
+    for (int j = 0; j < node->size; j++)
+        kernel_node_free(node->operands[j]);
+    if (node->operands)
+        mm_free("kernel: operands", node->operands);
+    mm_free("kernel: node", node);
+}
+
+
+typedef struct {
+    FunctionDeclarationAtom *fd;
+    Atom *self, *main;
+    Kernel *kernel;
+} KernelCompiler;
+
+// record a name resolved in the main scope, to be checked on application
+static void kernel_compiler_name(KernelCompiler *c, Atom *name, Atom *bind) {
+    Kernel *kernel = c->kernel;
+    for (int j = 0; j < kernel->names_size; j++)
+        if (kernel->names[j] == name)
+            return;
+
+    Atom **names = mm_malloc("kernel: names", (kernel->names_size+1) * sizeof *names);
+    Atom **binds = mm_malloc("kernel: binds", (kernel->names_size+1) * sizeof *binds);
+    for (int j = 0; j < kernel->names_size; j++)
+        names[j] = kernel->names[j], binds[j] = kernel->binds[j];
+    names[kernel->names_size] = name;
+    binds[kernel->names_size] = bind;
+
+    if (kernel->names_size > 0) {
+        mm_free("kernel: names", kernel->names);
+        mm_free("kernel: binds", kernel->binds);
+    }
+    kernel->names = names;
+    kernel->binds = binds;
+    kernel->names_size++;
+}
+
+// compile the expression at `*pc`, advancing it; NULL if it is no kernel
+static KernelNode *kernel_compile_expression(KernelCompiler *c, AtomListNode **pc, int depth) {
+    if (!*pc)
+        return NULL;
+
+    Atom *atom = (*pc)->atom;
+    *pc = (*pc)->next;
+
+    if (depth > c->kernel->depth)
+        c->kernel->depth = depth;
+
+    KernelNode *node = NULL;
+
+    if (atom_integer_is(atom)) {
+        node = kernel_node_new(kernel_constant, 0, depth);
+        node->value = ((IntegerAtom *) atom->atom)->value;
+        return node;
+    }
+
+    else if (atom_name_is(atom)) {
+        int j = 0;
+        for (AtomListNode *parameter = c->fd ? c->fd->parameters->head : NULL; parameter; parameter = parameter->next, j++)
+            if (parameter->atom == atom) {
+                node = kernel_node_new(kernel_parameter, 0, depth);
+                node->value = j;
+                return node;
+            }
+
+        if (atom == c->self) {
+            if (!c->fd)
+                return NULL;
+            node = kernel_node_new(kernel_recurse, c->fd->arity, depth);
+        }
+
+        else {
+            Atom *bind = atom_scope_lookup_local(c->main, atom);
+            if (!bind) {
+                Kernel *kernel = c->kernel;
+                for (j = 0; j < kernel->captures_size && kernel->captures[j] != atom; j++)
+                    ;
+                if (j >= KERNEL_CAPTURES)
+                    return NULL;
+                if (j == kernel->captures_size)
+                    kernel->captures[kernel->captures_size++] = atom;
+
+                node = kernel_node_new(kernel_captured, 0, depth);
+                node->value = j;
+                return node;
+            }
+
+            if (atom_integer_is(bind)) {
+                kernel_compiler_name(c, atom, bind);
+                node = kernel_node_new(kernel_constant, 0, depth);
+                node->value = ((IntegerAtom *) bind->atom)->value;
+                return node;
+            }
+
+            if (!atom_function_is(bind) || !primitive_integer(((FunctionAtom *) bind->atom)->primitive))
+                return NULL;
+
+            kernel_compiler_name(c, atom, bind);
+            node = kernel_node_new(kernel_primitive, 2, depth);
+            node->primitive = ((FunctionAtom *) bind->atom)->primitive;
+        }
+    }
+
+    else if (atom_primitive_is(atom)) {
+        char p = ((PrimitiveAtom *) atom->atom)->c;
+        if (p == '?')
+            node = kernel_node_new(kernel_conditional, 3, depth);
+        else if (p == '|')
+            node = kernel_node_new(kernel_or, 2, depth);
+        else if (p == '&')
+            node = kernel_node_new(kernel_and, 2, depth);
+        else
+            return NULL;
+    }
+
+    else
+        return NULL;
+
+    for (int j = 0; j < node->size; j++)
+        if (!(node->operands[j] = kernel_compile_expression(c, pc, depth+1)))
+            return kernel_node_free(node), NULL;
+
+    return node;
+}
+
+static Kernel *kernel_new(int arity) {
+    Kernel *kernel = mm_malloc("kernel: kernel", sizeof *kernel);
+    kernel->arity = arity;
+    kernel->body = NULL;
+    kernel->depth = 0;
+    kernel->names_size = 0;
+    kernel->names = kernel->binds = NULL;
+    kernel->captures_size = 0;
+    kernel->native = NULL;
+    kernel->applications = 0;
+    kernel->code = NULL;
+    kernel->code_size = 0;
+
+    return kernel;
+}
+
+// look up a registered native for a compiled kernel
+static Kernel *kernel_registered(Kernel *kernel) {
+    if (NativesSize > 0) {
+        char *signature = kernel_signature(kernel);
+        for (long j = 0; j < NativesSize; j++)
+            if (strcmp(Natives[j].signature, signature) == 0)
+                kernel->native = Natives[j].native;
+        mm_free("kernel: signature", signature);
+    }
+
+    return kernel;
+}
+
+Kernel *kernel_compile(FunctionDeclarationAtom *fd) {
+    if (fd->arity > KERNEL_ARITY || !fd->inline_frame)
+        return NULL;
+
+    Kernel *kernel = kernel_new(fd->arity);
+    KernelCompiler c = {
+        .fd = fd,
+        .self = atom_name_new(strdup("@")),
+        .main = main_scope(),
+        .kernel = kernel
+    };
+
+    // `@` is bound by the function itself, unless it is a parameter
+    AtomListNode *pc = fd->body->head;
+    kernel->body = kernel_compile_expression(&c, &pc, 0);
+    if (!kernel->body || pc) {
+        kernel_free(kernel);
+        return NULL;
+    }
+
+    return kernel_registered(kernel);
+}
+
+/* Compile the expression starting at `node` on its own, as a kernel of no
+   parameters, all the names it refers to besides the main scope's being
+   captured; `*end` is set to the node following it. NULL if it is no
+   kernel or refers to `@`, whose application it cannot be. */
+Kernel *kernel_compile_subexpression(AtomListNode *node, AtomListNode **end) {
+    Kernel *kernel = kernel_new(0);
+    KernelCompiler c = {
+        .fd = NULL,
+        .self = atom_name_new(strdup("@")),
+        .main = main_scope(),
+        .kernel = kernel
+    };
+
+    *end = node;
+    kernel->body = kernel_compile_expression(&c, end, 0);
+    if (!kernel->body) {
+        kernel_free(kernel);
+        return NULL;
+    }
+
+    return kernel_registered(kernel);
+}
+
+void kernel_free(Kernel *kernel) {
+    if (!kernel)
+        return;
+
+    jit_free(kernel);
+    kernel_node_free(kernel->body);
+    if (kernel->names_size > 0) {
+        mm_free("kernel: names", kernel->names);
+        mm_free("kernel: binds", kernel->binds);
+    }
+    mm_free("kernel: kernel", kernel);
+}
+
+
+typedef struct { char *str; long size, capacity; } KernelString;
+
+static void kernel_string_append(KernelString *s, const char *str) {
+    long length = strlen(str);
+    if (s->size + length + 1 > s->capacity) {
+        long capacity = 2 * (s->size + length + 1);
+        char *grown = mm_malloc("kernel: signature", capacity);
+        memcpy(grown, s->str, s->size + 1);
+        mm_free("kernel: signature", s->str);
+        s->str = grown;
+        s->capacity = capacity;
+    }
+
+    memcpy(s->str + s->size, str, length + 1);
+    s->size += length;
+}
+
+static void kernel_signature_node(KernelString *s, KernelNode *node) {
+    char token[32];
+
+    switch (node->operation) {
+        case kernel_constant: snprintf(token, sizeof token, " $%ld", node->value); break;
+        case kernel_parameter: snprintf(token, sizeof token, " p%ld", node->value); break;
+        case kernel_captured: snprintf(token, sizeof token, " c%ld", node->value); break;
+        case kernel_primitive: snprintf(token, sizeof token, " %s", primitive_symbol(node->primitive)); break;
+        case kernel_conditional: snprintf(token, sizeof token, " ?"); break;
+        case kernel_or: snprintf(token, sizeof token, " |"); break;
+        case kernel_and: snprintf(token, sizeof token, " &"); break;
+        case kernel_recurse: snprintf(token, sizeof token, " @"); break;
+    }
+    kernel_string_append(s, token);
+
+    for (int j = 0; j < node->size; j++)
+        kernel_signature_node(s, node->operands[j]);
+}
+
+/* The arity and the body in prefix notation, e.g. `1: ? < p0 $2 p0 ...`;
+   generated natives are matched to kernels by it. */
+char *kernel_signature(Kernel *kernel) {
+    KernelString s = { .str = mm_malloc("kernel: signature", 16), .size = 0, .capacity = 16 };
+    s.str[0] = '\0';
+
+    char arity[16];
+    snprintf(arity, sizeof arity, "%d:", kernel->arity);
+    kernel_string_append(&s, arity);
+    kernel_signature_node(&s, kernel->body);
+
+    return s.str;
+}
+
+
+// natives are looked up when kernels are compiled, so register them first
+void kernel_natives(const KernelEntry *natives, long size) {
+    Natives = natives;
+    NativesSize = size;
+}
+
+// whether a name's bind is the one a kernel was compiled with
+bool kernel_same_bind(Atom *bind, Atom *expected) {
+    if (bind == expected)
+        return true;
+
+    return atom_function_is(bind) && atom_function_is(expected)
+        && ((FunctionAtom *) bind->atom)->primitive != primitive_none
+        && ((FunctionAtom *) bind->atom)->primitive == ((FunctionAtom *) expected->atom)->primitive;
+}
+
+/* Evaluate a kernel's node on unboxed integers, the parameters' and
+   captured names' values in `values` and the body at depth `depth`; used
+   as long as a kernel has no native. */
+static integer kernel_evaluate(Kernel *kernel, KernelNode *node, long depth, const integer *values) {
+    integer A, B;
+
+    switch (node->operation) {
+        case kernel_constant:
+            return node->value;
+
+        case kernel_parameter:
+            return values[node->value];
+
+        case kernel_captured:
+            return values[kernel->arity + node->value];
+
+        case kernel_primitive:
+            A = kernel_evaluate(kernel, node->operands[0], depth, values);
+            B = kernel_evaluate(kernel, node->operands[1], depth, values);
+            if ((node->primitive == primitive_divide || node->primitive == primitive_modulo)
+            && (B == 0 || (A == LONG_MIN && B == -1)))
+                kernel_bail();
+            return primitive_evaluate(node->primitive, A, B);
+
+        case kernel_conditional:
+            return kernel_evaluate(kernel, node->operands[0], depth, values)
+                ? kernel_evaluate(kernel, node->operands[1], depth, values)
+                : kernel_evaluate(kernel, node->operands[2], depth, values);
+
+        // `|` chooses a non-zero first argument, `&` a zero one
+        case kernel_or:
+            A = kernel_evaluate(kernel, node->operands[0], depth, values);
+            return A ? A : kernel_evaluate(kernel, node->operands[1], depth, values);
+
+        case kernel_and:
+            A = kernel_evaluate(kernel, node->operands[0], depth, values);
+            return !A ? A : kernel_evaluate(kernel, node->operands[1], depth, values);
+
+        case kernel_recurse: {
+            integer arguments[KERNEL_ARITY + KERNEL_CAPTURES];
+            for (int j = 0; j < node->size; j++)
+                arguments[j] = kernel_evaluate(kernel, node->operands[j], depth, values);
+            for (int j = 0; j < kernel->captures_size; j++)
+                arguments[kernel->arity + j] = values[kernel->arity + j];
+
+            // the called body is interpreted one level deeper than `@`
+            long body = depth + node->depth + 1;
+            if (body + kernel->depth + 1 >= GlobOpt.maximum_interpretation_recursion_depth || BUDGET_STEP())
+                kernel_bail();
+            return kernel_evaluate(kernel, kernel->body, body, arguments);
+        }
+    }
+
+    return 0;
+}
+
+/* Apply a kernel to arguments, with the body at interpretation depth
+   `depth` and resolving names in the function's scope; false if the
+   application has to be interpreted instead. Only the result is boxed. */
+bool kernel_apply(Kernel *kernel, Atom *scope, long depth, Atom **arguments, integer *value) {
+    if (!kernel->native && GlobOpt.jit && ++kernel->applications == JIT_THRESHOLD)
+        kernel->native = jit_compile(kernel);
+
+    integer values[KERNEL_ARITY + KERNEL_CAPTURES];
+    for (int j = 0; j < kernel->arity; j++) {
+        if (!atom_integer_is(arguments[j]))
+            return false;
+        values[j] = ((IntegerAtom *) arguments[j]->atom)->value;
+    }
+
+    // a name unbound at the application is left to the interpreter to report
+    for (int j = 0; j < kernel->names_size; j++) {
+        Atom *bind = atom_scope_lookup(scope, kernel->names[j]);
+        if (!bind || !kernel_same_bind(bind, kernel->binds[j]))
+            return false;
+    }
+
+    for (int j = 0; j < kernel->captures_size; j++) {
+        Atom *bind = atom_scope_lookup(scope, kernel->captures[j]);
+        if (!bind || !atom_integer_is(bind))
+            return false;
+        values[kernel->arity + j] = ((IntegerAtom *) bind->atom)->value;
+    }
+
+    if (setjmp(Bail))
+        return false;
+
+    if (kernel->native)
+        *value = kernel->native(depth, values);
+    else {
+        if (depth + kernel->depth + 1 >= GlobOpt.maximum_interpretation_recursion_depth || BUDGET_STEP())
+            kernel_bail();
+        *value = kernel_evaluate(kernel, kernel->body, depth, values);
+    }
+    return true;
+}
+
+void kernel_bail() {
+    longjmp(Bail, 1);
+}
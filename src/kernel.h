@@ -0,0 +1,72 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <stdbool.h>
+
+#include "atom.h"
+
+
+// kernels take at most this many parameters and captured names
+#define KERNEL_ARITY 4
+#define KERNEL_CAPTURES 4
+
+typedef enum {
+    kernel_constant,
+    kernel_parameter,
+    kernel_captured,
+    kernel_primitive,
+    kernel_conditional,
+    kernel_or,
+    kernel_and,
+    kernel_recurse
+} kernel_operation;
+
+/* A node's value is its constant or the index of its parameter or captured
+   name; its depth is the interpretation depth at which the interpreter
+   would evaluate it, relative to the function body. */
+typedef struct KernelNode KernelNode;
+struct KernelNode {
+    kernel_operation operation;
+    primitive_opcode primitive;
+    integer value;
+    int depth;
+    int size;
+    KernelNode **operands;
+};
+
+/* A compiled kernel, called with the depth of the body and its arguments
+   followed by the values of its captured names. */
+typedef integer (*KernelNative)(long depth, const integer *arguments);
+typedef struct { const char *signature; KernelNative native; } KernelEntry;
+
+/* Names the body refers to besides its parameters and `@` either have to be
+   bound to the main scope's binds or, if the main scope does not bind them,
+   are captured: they have to be bound to integers when the kernel is
+   applied. Natives are either registered or compiled just in time once a
+   kernel has been applied often enough (see jit.c). */
+struct Kernel {
+    int arity;
+    KernelNode *body;
+    int depth;
+    int names_size;
+    Atom **names, **binds;
+    int captures_size;
+    Atom *captures[KERNEL_CAPTURES];
+    KernelNative native;
+
+    long applications;
+    void *code;
+    long code_size;
+};
+
+Kernel *kernel_compile(FunctionDeclarationAtom *fd);
+Kernel *kernel_compile_subexpression(AtomListNode *node, AtomListNode **end);
+void kernel_free(Kernel *kernel);
+char *kernel_signature(Kernel *kernel);
+
+void kernel_natives(const KernelEntry *natives, long size);
+bool kernel_same_bind(Atom *bind, Atom *expected);
+bool kernel_apply(Kernel *kernel, Atom *scope, long depth, Atom **arguments, integer *value);
+void kernel_bail();
+
+#endif
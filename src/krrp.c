@@ -7,33 +7,52 @@
 #include <string.h>
 
 #include "atom.h"
-#include "parse.h"
-#include "interpret.h"
 #include "debug.h"
-#include "util.h"
 #include "test.h"
 #include "memorymanagement.h"
 #include "argparse.h"
+#include "profile.h"
+#include "stats.h"
+#include "budget.h"
+#include "heapreport.h"
+#include "trace.h"
+#include "emit.h"
+#include "libkrrp.h"
 
-#include "Opt.h"
-extern Opt GlobOpt;
+#include "context.h"
 
 
 // memory-management-awareness
-#define RETURN return memorymanagement_free_all(),
-#define MAIN_ERR(...) return error(__VA_ARGS__), memorymanagement_free_all(), EXIT_FAILURE
+#define RETURN return krrp_context_free(ctx),
+#define MAIN_ERR(...) return error(__VA_ARGS__), krrp_context_free(ctx), EXIT_FAILURE
 
 
 int main(int argc, char **argv) {
 
-    // memory initialization
-    globalatomtable_init();
+    // the command line is handled within the context it interprets in
+    krrp_context *ctx = krrp_context_new();
+    if (!ctx)
+        return EXIT_FAILURE;
+    context_enter(ctx);
 
     PArgs pargs = parse_args(argc, argv);
     if (!pargs.parsing_successful)
         MAIN_ERR("Unsuccessful argument parsing.\n");
 
     GlobOpt.string_view = pargs.string_view;
+    GlobOpt.memstats = pargs.memstats;
+    GlobOpt.profile = pargs.profile != NULL;
+    GlobOpt.memprofile = pargs.memprofile;
+    GlobOpt.stats = pargs.stats;
+    GlobOpt.heap_report = pargs.heap_report;
+    GlobOpt.trace = pargs.trace != NULL;
+    GlobOpt.optimization_level = pargs.optimization_level;
+    GlobOpt.jit = pargs.jit;
+    GlobOpt.jobs = pargs.jobs;
+    GlobOpt.maximum_steps = pargs.maximum_steps;
+    GlobOpt.maximum_bytes = pargs.maximum_bytes;
+    GlobOpt.maximum_seconds = pargs.maximum_seconds;
+    GlobOpt.cache_directory = pargs.cache;
 
     if (pargs.err < 0) GlobOpt.ERR = false;
     if (pargs.wrn < 0) GlobOpt.WRN = false;
@@ -60,6 +79,50 @@ int main(int argc, char **argv) {
             "\n"\
             "    -c, --code [source]: Intepret specified source.\n"\
             "\n"\
+            "    --O0, --O1         : Disable or enable (default) constant\n"\
+            "                         folding and propagation, the inlining of\n"\
+            "                         small functions and the sharing of\n"\
+            "                         repeated subexpressions.\n"\
+            "    --[no]jit          : Toggle compiling integer kernels to\n"\
+            "                         x86-64 code once they are hot (on by\n"\
+            "                         default).\n"\
+            "    --emit-c [file]    : Compile the integer kernels of the\n"\
+            "                         sources and their imports to C and\n"\
+            "                         write a program interpreting them\n"\
+            "                         with the kernels compiled.\n"\
+            "    --jobs [n]         : Number of worker processes of [pmap],\n"\
+            "                         [pfilter] and [preduce] (default: one\n"\
+            "                         per processor).\n"\
+            "    --cache [dir]      : Keep sources and imports parsed and\n"\
+            "                         optimized in the directory, reusing\n"\
+            "                         them while unchanged.\n"\
+            "\n"\
+            "    --max-steps [n]    : Stop a source after n interpreted atoms\n"\
+            "                         and evaluated kernel bodies.\n"\
+            "    --max-bytes [n]    : Stop a source once it allocated n bytes.\n"\
+            "    --max-time [s]     : Stop a source after s seconds.\n"\
+            "\n"\
+            "    --memstats         : Print memory management counters\n"\
+            "                         as JSON to stderr on exit.\n"\
+            "    --profile [file]   : Profile krrp functions; print a report\n"\
+            "                         to stderr and write collapsed stacks\n"\
+            "                         (for flame graphs) to the file.\n"\
+            "    --memprofile       : Print allocations, frees, live and peak\n"\
+            "                         bytes per allocation site and a heap\n"\
+            "                         timeline to stderr on exit.\n"\
+            "    --stats            : Print interpreter counters as JSON to\n"\
+            "                         stderr on exit and on SIGUSR1 and the\n"\
+            "                         budgets used on exit.\n"\
+            "    --heap-report      : Print live atoms and bytes by type, the\n"\
+            "                         largest strings and scopes and scope\n"\
+            "                         chains retained by closures to stderr\n"\
+            "                         on exit and, on SIGUSR2, after the\n"\
+            "                         current top-level statement.\n"\
+            "    --trace [file]     : Write a Chrome trace-event file with\n"\
+            "                         spans for function applications,\n"\
+            "                         imports, parses and statements.\n"\
+            "    --trace-sample [n] : Trace every n-th function application.\n"\
+            "\n"\
             "    --[no]error        : Toggle error messages (on by default).\n"\
             "    --[no]warning      : Toggle warning messages (on by default).\n"\
             "    --[no]info         : Toggle info messages (off by default).\n"\
@@ -87,25 +150,51 @@ int main(int argc, char **argv) {
     if (atomlist_empty(pargs.codes))
         MAIN_ERR("No source code given. When in doubt, use the '--help' option.\n");
 
-    while (!atomlist_empty(pargs.codes)) {
-        const char *source = string_from_atom(atomlist_pop_front(pargs.codes));
+    if (pargs.emit_c) {
+        if (!emit_c(pargs.emit_c, pargs.codes))
+            MAIN_ERR("Could not emit C.\n");
 
-        info("=== Source ===\n");
-        print_escaped_source(source);
+        RETURN EXIT_SUCCESS;
+    }
 
-        info("=== Parsing ===\n");
-        AtomList *parsed = parse(source);
-        if (parsed == NULL)
+    if (GlobOpt.profile)
+        profile_start();
+    if (GlobOpt.stats)
+        stats_install_signal_handler();
+    if (GlobOpt.heap_report)
+        heap_report_install_signal_handler();
+    if (GlobOpt.trace && !trace_open(pargs.trace, pargs.trace_sample))
+        MAIN_ERR("Could not open trace.\n");
+
+    // a source exhausting a budget stops the interpretation
+    krrp_budget exhausted = krrp_budget_none;
+    while (!atomlist_empty(pargs.codes) && !exhausted) {
+        if (!krrp_run(ctx, string_from_atom(atomlist_pop_front(pargs.codes)), stdout))
             MAIN_ERR("Could not parse source.\n");
-        info("    %s\n", string_from_atom(atomlist_representation(parsed)));
+        exhausted = krrp_exhausted(ctx);
+    }
 
-        info("=== Interpreting ===\n");
-        Atom *scope = atom_scope_new_double_empty();
-        inject_main(scope);
-        while (!atomlist_empty(parsed))
-            printf("%s\n", atom_repr(interpret_with_scope(parsed, scope)));
+    if (GlobOpt.stats) {
+        stats_print_json(stderr);
+        budget_print_json(stderr);
+    }
+    if (GlobOpt.heap_report)
+        heap_report(stderr);
+
+    // trace and profile share the function names kept by the profiler
+    bool written = true;
+    if (GlobOpt.trace)
+        written &= trace_close();
+    if (GlobOpt.profile) {
+        profile_report(stderr);
+        written &= profile_write_collapsed(pargs.profile);
     }
+    profile_free();
 
+    if (!written)
+        MAIN_ERR("Could not write trace or profile.\n");
+    if (exhausted)
+        RETURN EXIT_FAILURE;
 
     RETURN EXIT_SUCCESS;
 }
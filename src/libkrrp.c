@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libkrrp.h"
+#include "atom.h"
+#include "parse.h"
+#include "interpret.h"
+#include "optimize.h"
+#include "memorymanagement.h"
+#include "profile.h"
+#include "trace.h"
+#include "heapreport.h"
+#include "stats.h"
+#include "budget.h"
+#include "cache.h"
+#include "debug.h"
+#include "util.h"
+
+#include "context.h"
+
+
+_Thread_local krrp_context *GlobContext = NULL;
+
+krrp_context *context_enter(krrp_context *ctx) {
+    krrp_context *previous = GlobContext;
+    GlobContext = ctx;
+    return previous;
+}
+
+void context_leave(krrp_context *previous) {
+    GlobContext = previous;
+}
+
+
+// the context owns the memory management counters, so it is not counted
+krrp_context *krrp_context_new() {
+    krrp_context *ctx = calloc(1, sizeof *ctx);
+    if (!ctx)
+        return NULL;
+
+    ctx->opt = OptDefaults;
+
+    krrp_context *previous = context_enter(ctx);
+    budget_start();
+    budget_stop();
+    globalatomtable_init();
+    context_leave(previous);
+
+    return ctx;
+}
+
+void krrp_context_free(krrp_context *ctx) {
+    krrp_context *previous = context_enter(ctx);
+
+    if (ctx->trace)
+        trace_close();
+    profile_free();
+    memorymanagement_free_all();
+
+    context_leave(previous != ctx ? previous : NULL);
+    free(ctx);
+}
+
+Opt *krrp_options(krrp_context *ctx) {
+    return &ctx->opt;
+}
+
+bool krrp_import(krrp_context *ctx, const char *name, const char *source) {
+    krrp_context *previous = context_enter(ctx);
+
+    Atom *name_a = atom_name_new(strdup(name));
+    bool registered = !atom_scope_contains_bind(ImportedSource, name_a);
+    if (registered)
+        atom_scope_push(ImportedSource, name_a, atom_string_newfl(source));
+
+    context_leave(previous);
+    return registered;
+}
+
+/* A program is interpreted in a scope of its own, above which lies the
+   main scope its imports bind into; with a prelude, both lie below the
+   prelude's scope, whose binds programs thus see but cannot change. */
+static Atom *context_scope(bool prelude) {
+    if (prelude && GlobContext->prelude)
+        return GlobContext->prelude;
+
+    if (prelude || !GlobContext->prelude) {
+        Atom *scope = atom_scope_new_double_empty();
+        inject_main(scope);
+        if (prelude)
+            GlobContext->prelude = scope;
+        return scope;
+    }
+
+    Atom *main = atom_scope_new_inherits(GlobContext->prelude);
+    atom_scope_index(main);
+    Atom *scope = atom_scope_new_inherits(main);
+    atom_scope_index(scope);
+    return scope;
+}
+
+static bool context_run(krrp_context *ctx, const char *source, FILE *out, bool prelude) {
+    krrp_context *previous = context_enter(ctx);
+
+    info("=== Source ===\n");
+    print_escaped_source(source);
+
+    info("=== Parsing ===\n");
+    double trace_start = GlobOpt.trace ? trace_begin() : -1;
+    AtomList *parsed = cache_parse(source);
+    if (GlobOpt.trace)
+        trace_span("parse", "source", NULL, 0, trace_start);
+    if (parsed == NULL)
+        return context_leave(previous), false;
+    info("    %s\n", string_from_atom(atomlist_representation(parsed)));
+
+    info("=== Interpreting ===\n");
+    Atom *scope = context_scope(prelude);
+    budget_start();
+    for (long statement = 1; !atomlist_empty(parsed); statement++) {
+        trace_start = GlobOpt.trace ? trace_begin() : -1;
+        Atom *value = interpret_with_scope(parsed, scope);
+        if (out)
+            fprintf(out, "%s\n", atom_repr(value));
+        if (GlobOpt.trace)
+            trace_span("statement", "statement", NULL, statement, trace_start);
+
+        if (HeapReportRequested) {
+            HeapReportRequested = 0;
+            heap_report(stderr);
+        }
+    }
+    budget_stop();
+
+    context_leave(previous);
+    return true;
+}
+
+bool krrp_run(krrp_context *ctx, const char *source, FILE *out) {
+    return context_run(ctx, source, out, false);
+}
+
+bool krrp_prelude(krrp_context *ctx, const char *source, FILE *out) {
+    return context_run(ctx, source, out, true);
+}
+
+char *krrp_eval(krrp_context *ctx, const char *source) {
+    char *output = NULL;
+    size_t size = 0;
+
+    FILE *out = open_memstream(&output, &size);
+    if (!out)
+        return NULL;
+
+    bool parsed = krrp_run(ctx, source, out);
+    fclose(out);
+
+    if (!parsed) {
+        free(output);
+        return NULL;
+    }
+
+    return output;
+}
+
+void krrp_checkpoint(krrp_context *ctx) {
+    krrp_context *previous = context_enter(ctx);
+    mm_checkpoint();
+    context_leave(previous);
+}
+
+// profiles and traces refer to functions by their bodies, which would be freed
+bool krrp_rollback(krrp_context *ctx) {
+    krrp_context *previous = context_enter(ctx);
+
+    bool rolled_back = false;
+    if (GlobOpt.profile || GlobOpt.trace)
+        error("rollback :: Cannot roll back while profiling or tracing.\n");
+    else if (!(rolled_back = mm_rollback()))
+        error("rollback :: No checkpoint taken.\n");
+
+    context_leave(previous);
+    return rolled_back;
+}
+
+krrp_budget krrp_exhausted(krrp_context *ctx) {
+    return ctx->budget.exhausted;
+}
+
+long krrp_errors(krrp_context *ctx) {
+    return ctx->error_count;
+}
+
+void krrp_stats(krrp_context *ctx, FILE *f) {
+    krrp_context *previous = context_enter(ctx);
+
+    stats_print_json(f);
+    mm_print_status_json(f);
+    budget_print_json(f);
+
+    context_leave(previous);
+}
@@ -0,0 +1,60 @@
+#ifndef LIBKRRP_H
+#define LIBKRRP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "Opt.h"
+
+
+/* Embedding krrp (libkrrp)
+
+    An interpreter instance is a `krrp_context`. Contexts share no mutable
+    state, so threads may each interpret in their own context concurrently;
+    a single context must only be used by one thread at a time. Every call
+    interprets in the context it is given. */
+
+typedef struct krrp_context krrp_context;
+
+krrp_context *krrp_context_new();
+void krrp_context_free(krrp_context *ctx);
+
+// the context's options, which may be changed between calls
+Opt *krrp_options(krrp_context *ctx);
+
+// make `source` importable as `\name`; false if that name is already registered
+bool krrp_import(krrp_context *ctx, const char *name, const char *source);
+
+// interpret `source`, writing every top-level statement's value to `out`
+// (unless NULL); false if it could not be parsed
+bool krrp_run(krrp_context *ctx, const char *source, FILE *out);
+
+// interpret `source` like `krrp_run`, keeping its binds and imports visible
+// to every program run afterwards
+bool krrp_prelude(krrp_context *ctx, const char *source, FILE *out);
+
+// interpret `source`, returning what `krrp_run` would write (to be freed
+// with `free`) or NULL if it could not be parsed
+char *krrp_eval(krrp_context *ctx, const char *source);
+
+/* A rollback frees every atom created since the last checkpoint and drops
+   the preludes and imports registered since, in time proportional to what
+   it frees; it fails without a checkpoint and while profiling or tracing.
+   A checkpoint may be rolled back to any number of times. */
+void krrp_checkpoint(krrp_context *ctx);
+bool krrp_rollback(krrp_context *ctx);
+
+/* Budgets (the options `maximum_steps`, `maximum_bytes` and
+   `maximum_seconds`, unlimited if zero) apply to each run on its own; a run
+   exhausting one is stopped, reporting an error. */
+typedef enum { krrp_budget_none, krrp_budget_steps, krrp_budget_bytes, krrp_budget_time } krrp_budget;
+krrp_budget krrp_exhausted(krrp_context *ctx);
+
+long krrp_errors(krrp_context *ctx);
+
+// write the interpreter counters (counted with `stats` set), the memory
+// management counters and what the last run used of its budgets as JSON,
+// one object per line
+void krrp_stats(krrp_context *ctx, FILE *f);
+
+#endif
@@ -1,24 +1,232 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
 
 #include "memorymanagement.h"
 #include "atom.h"
+#include "kernel.h"
+#include "optimize.h"
+#include "budget.h"
 #include "debug.h"
 
 
-extern AtomList* GlobalAtomTable;
-extern AtomList* GlobalAtomTableMutable;
-
 static void memorymanagement_ABORT(const char *msg);
 static void memorymanagement_FATAL_ERROR(const char *msg);
 
-static MemoryManagementDebug dbg = {
-    .allocations = 0,
-    .deallocations = 0,
-    .nullpointer_frees = 0,
-    .allocated_bytes = 0
+#define dbg (GlobContext->mm)
+
+
+/* Allocation-site profiling (`--memprofile`)
+
+    Allocations are attributed to the site string passed to `mm_malloc`.
+    Live blocks are kept in an open-addressing table from pointer to size and
+    site, so that a free (whose own message names the freeing code) is
+    charged to the site which allocated the block. Blocks allocated before
+    profiling was enabled are not tracked. The heap size is sampled every
+    `interval` allocations; when the timeline is full, every other sample is
+    dropped and the interval doubled. The profiler's own tables use plain
+    `malloc`. */
+
+typedef struct {
+    const char *site;
+    long allocations, frees;
+    long live_bytes, peak_bytes, total_bytes;
+} MemProfileSite;
+
+typedef struct { void *ptr; size_t size; long site; } MemProfileBlock;
+typedef struct { long allocations; long live_bytes; } MemProfileSample;
+
+#define MEMPROFILE_SAMPLES 64
+
+struct MemProfileState {
+    MemProfileSite *sites;
+    long sites_size, sites_capacity;
+
+    MemProfileBlock *blocks;
+    long blocks_size, blocks_capacity;
+
+    long live_bytes, peak_bytes;
+
+    MemProfileSample timeline[MEMPROFILE_SAMPLES];
+    long samples, interval;
 };
 
+static void *memprofile_calloc(size_t n, size_t size) {
+    void *ptr = calloc(n, size);
+    if (!ptr)
+        memorymanagement_FATAL_ERROR("memprofile: Out of memory.");
+    return ptr;
+}
+
+// the context's profile, allocated on first use
+static MemProfileState *memprofile_state() {
+    if (!GlobContext->memory_profile) {
+        GlobContext->memory_profile = memprofile_calloc(1, sizeof *GlobContext->memory_profile);
+        GlobContext->memory_profile->interval = 1024;
+    }
+    return GlobContext->memory_profile;
+}
+
+#define Profile (*memprofile_state())
+
+static unsigned long memprofile_hash(void *ptr) {
+    unsigned long h = (unsigned long) ptr;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    return h;
+}
+
+static long memprofile_site(const char *msg) {
+    // sites are string literals; compare by content as equal literals need
+    // not share an address across translation units
+    for (long j = 0; j < Profile.sites_size; j++)
+        if (Profile.sites[j].site == msg || strcmp(Profile.sites[j].site, msg) == 0)
+            return j;
+
+    if (Profile.sites_size >= Profile.sites_capacity) {
+        Profile.sites_capacity = Profile.sites_capacity > 0 ? 2*Profile.sites_capacity : 64;
+        Profile.sites = realloc(Profile.sites, Profile.sites_capacity * sizeof *Profile.sites);
+        if (!Profile.sites)
+            memorymanagement_FATAL_ERROR("memprofile: Out of memory.");
+    }
+
+    Profile.sites[Profile.sites_size] = (MemProfileSite) { .site = msg };
+    return Profile.sites_size++;
+}
+
+static void memprofile_insert(MemProfileBlock block);
+
+static void memprofile_grow() {
+    MemProfileBlock *blocks = Profile.blocks;
+    long capacity = Profile.blocks_capacity;
+
+    Profile.blocks_capacity = capacity > 0 ? 2*capacity : 4096;
+    Profile.blocks = memprofile_calloc(Profile.blocks_capacity, sizeof *Profile.blocks);
+    Profile.blocks_size = 0;
+
+    for (long j = 0; j < capacity; j++)
+        if (blocks[j].ptr)
+            memprofile_insert(blocks[j]);
+
+    free(blocks);
+}
+
+static void memprofile_insert(MemProfileBlock block) {
+    if (2*(Profile.blocks_size+1) > Profile.blocks_capacity)
+        memprofile_grow();
+
+    long mask = Profile.blocks_capacity-1;
+    long j = memprofile_hash(block.ptr) & mask;
+    while (Profile.blocks[j].ptr)
+        j = (j+1) & mask;
+
+    Profile.blocks[j] = block;
+    Profile.blocks_size++;
+}
+
+// removes the block with backward-shift deletion; false if untracked
+static bool memprofile_remove(void *ptr, MemProfileBlock *block) {
+    if (Profile.blocks_capacity == 0)
+        return false;
+
+    long mask = Profile.blocks_capacity-1;
+    long j = memprofile_hash(ptr) & mask;
+    while (Profile.blocks[j].ptr != ptr) {
+        if (!Profile.blocks[j].ptr)
+            return false;
+        j = (j+1) & mask;
+    }
+
+    *block = Profile.blocks[j];
+    Profile.blocks_size--;
+
+    for (long k = (j+1) & mask; Profile.blocks[k].ptr; k = (k+1) & mask) {
+        long home = memprofile_hash(Profile.blocks[k].ptr) & mask;
+        if (((k - home) & mask) >= ((k - j) & mask)) {
+            Profile.blocks[j] = Profile.blocks[k];
+            j = k;
+        }
+    }
+    Profile.blocks[j].ptr = NULL;
+
+    return true;
+}
+
+static void memprofile_malloc(const char *msg, void *ptr, size_t n) {
+    long site = memprofile_site(msg);
+    memprofile_insert((MemProfileBlock) { .ptr = ptr, .size = n, .site = site });
+
+    MemProfileSite *s = &Profile.sites[site];
+    s->allocations++;
+    s->total_bytes += n;
+    if ((s->live_bytes += n) > s->peak_bytes)
+        s->peak_bytes = s->live_bytes;
+
+    if ((Profile.live_bytes += n) > Profile.peak_bytes)
+        Profile.peak_bytes = Profile.live_bytes;
+
+    if (dbg.allocations % Profile.interval == 0) {
+        if (Profile.samples >= MEMPROFILE_SAMPLES) {
+            for (long j = 0; j < MEMPROFILE_SAMPLES/2; j++)
+                Profile.timeline[j] = Profile.timeline[2*j+1];
+            Profile.samples = MEMPROFILE_SAMPLES/2;
+            Profile.interval *= 2;
+        }
+
+        if (dbg.allocations % Profile.interval == 0)
+            Profile.timeline[Profile.samples++] = (MemProfileSample) {
+                .allocations = dbg.allocations,
+                .live_bytes = Profile.live_bytes
+            };
+    }
+}
+
+static void memprofile_free(void *ptr) {
+    MemProfileBlock block;
+    if (!memprofile_remove(ptr, &block))
+        return;
+
+    MemProfileSite *s = &Profile.sites[block.site];
+    s->frees++;
+    s->live_bytes -= block.size;
+    Profile.live_bytes -= block.size;
+}
+
+static int memprofile_compare(const void *a, const void *b) {
+    long x = ((const MemProfileSite *) a)->peak_bytes, y = ((const MemProfileSite *) b)->peak_bytes;
+    return (x < y) - (x > y);
+}
+
+static void memprofile_report(FILE *f) {
+    qsort(Profile.sites, Profile.sites_size, sizeof *Profile.sites, memprofile_compare);
+
+    fprintf(f, "=== Memory profile (live %ld bytes, peak %ld bytes) ===\n", Profile.live_bytes, Profile.peak_bytes);
+    fprintf(f, "%12s %12s %12s %12s %14s  %s\n", "allocations", "frees", "live bytes", "peak bytes", "total bytes", "site");
+    for (long j = 0; j < Profile.sites_size; j++) {
+        MemProfileSite *s = &Profile.sites[j];
+        fprintf(f, "%12ld %12ld %12ld %12ld %14ld  %s\n",
+            s->allocations, s->frees, s->live_bytes, s->peak_bytes, s->total_bytes, s->site);
+    }
+
+    fprintf(f, "=== Heap timeline ===\n");
+    fprintf(f, "%12s %12s\n", "allocation", "live bytes");
+    for (long j = 0; j < Profile.samples; j++)
+        fprintf(f, "%12ld %12ld\n", Profile.timeline[j].allocations, Profile.timeline[j].live_bytes);
+}
+
+static void memprofile_reset() {
+    if (!GlobContext->memory_profile)
+        return;
+
+    free(Profile.sites);
+    free(Profile.blocks);
+    free(GlobContext->memory_profile);
+    GlobContext->memory_profile = NULL;
+}
+
+
 void *mm_malloc(const char *msg, size_t n) {
     void *ptr = malloc(n);
 
@@ -28,12 +236,21 @@ void *mm_malloc(const char *msg, size_t n) {
     dbg.allocations++;
     dbg.allocated_bytes += n;
 
+    if ((GlobContext->budget.bytes_left -= n) < 0)
+        budget_exhaust(krrp_budget_bytes);
+
+    if (GlobOpt.memprofile)
+        memprofile_malloc(msg, ptr, n);
+
     return ptr;
 }
 
 void mm_free(const char *msg, void *ptr) {
     if (!ptr) { dbg.nullpointer_frees++; return; }
 
+    if (GlobOpt.memprofile)
+        memprofile_free(ptr);
+
     free(ptr);
     dbg.deallocations++;
 }
@@ -43,6 +260,10 @@ void mm_prematurely_free_mutable(Atom *atom) {
     atom_free(atom);
 }
 
+long mm_allocations() {
+    return dbg.allocations;
+}
+
 void mm_print_status() {
     info("* Memory management status *\n");
     info("Allocated        : %ld\n", dbg.allocations);
@@ -56,6 +277,11 @@ void mm_print_status() {
         error("Conclusio: PROBLEMATIC MEMORY STATE.\n");
 }
 
+void mm_print_status_json(FILE *f) {
+    fprintf(f, "{\"allocations\": %ld, \"deallocations\": %ld, \"nullpointer_frees\": %ld, \"allocated_bytes\": %ld}\n",
+        dbg.allocations, dbg.deallocations, dbg.nullpointer_frees, dbg.allocated_bytes);
+}
+
 static void memorymanagement_ABORT(const char *msg) {
     memorymanagement_free_all();
 
@@ -71,13 +297,138 @@ static void memorymanagement_FATAL_ERROR(const char *msg) {
 
 
 void memorymanagement_free_all() {
+    if (GlobOpt.memprofile) {
+        memprofile_report(stderr);
+        GlobOpt.memprofile = false;
+    }
+    memprofile_reset();
+
     if (GlobalAtomTable)
         mm_free_gat(GlobalAtomTable);
 
     if (GlobalAtomTableMutable)
         mm_free_gat(GlobalAtomTableMutable);
 
+    globalatomindex_free();
+
+    if (GlobContext->checkpoint.lazy)
+        mm_free("mm: lazy atoms", GlobContext->checkpoint.lazy);
+    GlobContext->checkpoint.lazy = NULL;
+
     mm_print_status();
+    if (GlobOpt.memstats)
+        mm_print_status_json(stderr);
+}
+
+
+/* Checkpoints (`krrp_checkpoint`, `krrp_rollback`)
+
+    New atoms are pushed to the front of their global table, so the atoms
+    created since a checkpoint are exactly those in front of the heads the
+    tables had then. A rollback frees them, dropping the anti-aliased ones
+    from the index, in time proportional to their number. Older atoms do not
+    change, except for the scopes binds are added to across calls -- the
+    imported sources and the prelude's scopes --, which lose the binds made
+    since, the lazy bodies parsed since (see parse.c), which are emptied to
+    be parsed anew, and the thunks forced since (see interpret.c), which
+    forget their closure. Lazily created atoms the context keeps (null atoms,
+    the shared main scope, the prelude) are forgotten if they are younger. */
+
+void mm_checkpoint() {
+    MemoryCheckpoint *c = &GlobContext->checkpoint;
+
+    c->taken = true;
+    c->atoms = GlobalAtomTable->head;
+    c->mutable_atoms = GlobalAtomTableMutable->head;
+    c->name_count = GlobContext->name_count;
+    c->null_atoms[0] = GlobContext->null_atom;
+    c->null_atoms[1] = GlobContext->nullcondition_atom;
+    c->null_atoms[2] = GlobContext->nullscope_atom;
+    c->null_atoms[3] = GlobContext->Enull_atom;
+    c->main_scope = GlobContext->main_scope;
+    c->prelude = GlobContext->prelude;
+
+    c->scopes_size = 0;
+    c->scopes[c->scopes_size++] = ImportedSource;
+    if (c->prelude) {
+        c->scopes[c->scopes_size++] = c->prelude;
+        c->scopes[c->scopes_size++] = ((ScopeAtom *) c->prelude->atom)->upper_scope;
+    }
+    for (int j = 0; j < c->scopes_size; j++)
+        c->scope_sizes[j] = atomlist_len(((ScopeAtom *) c->scopes[j]->atom)->names);
+    c->lazy_size = 0;
+    if (!c->lazy) {
+        c->lazy_capacity = 16;
+        c->lazy = mm_malloc("mm: lazy atoms", c->lazy_capacity * sizeof *c->lazy);
+    }
+}
+
+static void mm_checkpoint_lazy(FunctionDeclarationAtom *fd, ThunkAtom *thunk) {
+    MemoryCheckpoint *c = &GlobContext->checkpoint;
+    if (!c->taken)
+        return;
+
+    if (c->lazy_size >= c->lazy_capacity) {
+        long capacity = 2 * c->lazy_capacity;
+        void *lazy = mm_malloc("mm: lazy atoms", capacity * sizeof *c->lazy);
+        memcpy(lazy, c->lazy, c->lazy_size * sizeof *c->lazy);
+        mm_free("mm: lazy atoms", c->lazy);
+        c->lazy = lazy;
+        c->lazy_capacity = capacity;
+    }
+
+    c->lazy[c->lazy_size].parsed = fd;
+    c->lazy[c->lazy_size].forced = thunk;
+    c->lazy_size++;
+}
+
+void mm_checkpoint_parsed(FunctionDeclarationAtom *fd) { mm_checkpoint_lazy(fd, NULL); }
+void mm_checkpoint_forced(ThunkAtom *thunk) { mm_checkpoint_lazy(NULL, thunk); }
+
+static void mm_rollback_gat(AtomList *gat, AtomListNode *head) {
+    while (gat->head && gat->head != head) {
+        Atom *atom = atomlist_pop_front(gat);
+        globalatomindex_remove(atom);
+        atom_free(atom);
+    }
+}
+
+bool mm_rollback() {
+    MemoryCheckpoint *c = &GlobContext->checkpoint;
+    if (!c->taken)
+        return false;
+
+    // names about to be freed are still needed to clear the scopes' tables
+    for (int j = 0; j < c->scopes_size; j++)
+        atom_scope_truncate(c->scopes[j], c->scope_sizes[j]);
+
+    for (long j = 0; j < c->lazy_size; j++) {
+        FunctionDeclarationAtom *fd = c->lazy[j].parsed;
+        if (fd) {
+            while (!atomlist_empty(fd->body))
+                atomlist_pop_front(fd->body);
+            kernel_free(fd->kernel);
+            fd->kernel = NULL;
+            fd->shared = -1;
+            fd->lazy = true;
+        }
+        else
+            c->lazy[j].forced->value = NULL;
+    }
+    c->lazy_size = 0;
+
+    mm_rollback_gat(GlobalAtomTableMutable, c->mutable_atoms);
+    mm_rollback_gat(GlobalAtomTable, c->atoms);
+
+    GlobContext->name_count = c->name_count;
+    GlobContext->null_atom = c->null_atoms[0];
+    GlobContext->nullcondition_atom = c->null_atoms[1];
+    GlobContext->nullscope_atom = c->null_atoms[2];
+    GlobContext->Enull_atom = c->null_atoms[3];
+    GlobContext->main_scope = c->main_scope;
+    GlobContext->prelude = c->prelude;
+
+    return true;
 }
 
 
@@ -127,31 +478,56 @@ void atom_free(Atom *atom) {
         FunctionDeclarationAtom *functiondeclaration_atom = atom->atom;
         atomlist_free(functiondeclaration_atom->parameters);
         atomlist_free(functiondeclaration_atom->body);
+        kernel_free(functiondeclaration_atom->kernel);
+        mm_free("parse_functiondeclaration", functiondeclaration_atom->source);
+        if (functiondeclaration_atom->substitutions)
+            atomlist_free(functiondeclaration_atom->substitutions);
+        optimize_scope_release(functiondeclaration_atom->enclosing);
         mm_free("atom_free: functiondeclaration_atom", functiondeclaration_atom);
     }
     else if (atom->type == atom_type_function) {
+        /* parameters and body are owned by the function declaration */
         FunctionAtom *function_atom = atom->atom;
-        if (function_atom->parameters)
-            atomlist_free(function_atom->parameters);
-        if (function_atom->body)
-            atomlist_free(function_atom->body);
-        if (function_atom->primitive)
-            mm_free("atom_free: function_atom->primitive", function_atom->primitive);
         mm_free("atom_free: function_atom", function_atom);
     }
     else if (atom->type == atom_type_scope) {
         ScopeAtom *scope_atom = atom->atom;
         atomlist_free(scope_atom->names);
         atomlist_free(scope_atom->binds);
+        if (scope_atom->table)
+            mm_free("atom_free: scope_atom->table", scope_atom->table);
         mm_free("atom_free: scope_atom", scope_atom);
     }
+    else if (atom->type == atom_type_thunk) {
+        ThunkAtom *thunk_atom = atom->atom;
+        mm_free("atom_free: thunk_atom", thunk_atom);
+    }
+    else if (atom->type == atom_type_shared) {
+        SharedAtom *shared_atom = atom->atom;
+        mm_free("atom_free: shared_atom", shared_atom);
+    }
+    else if (atom->type == atom_type_inline) {
+        InlineAtom *inline_atom = atom->atom;
+        atomlist_free(inline_atom->expansion);
+        mm_free("atom_free: inline_atom->guards", inline_atom->guards);
+        mm_free("atom_free: inline_atom", inline_atom);
+    }
+    else if (atom->type == atom_type_unboxed) {
+        UnboxedAtom *unboxed_atom = atom->atom;
+        kernel_free(unboxed_atom->kernel);
+        mm_free("atom_free: unboxed_atom", unboxed_atom);
+    }
     else if (atom->type == atom_type_structinitializer) {
         StructInitializerAtom *structinitializer_atom = atom->atom;
         atomlist_free(structinitializer_atom->fields);
+        if (structinitializer_atom->layout)
+            mm_free("atom_free: structinitializer_atom->layout", structinitializer_atom->layout);
         mm_free("atom_free: structinitializer_atom", structinitializer_atom);
     }
     else if (atom->type == atom_type_struct) {
         StructAtom *struct_atom = atom->atom;
+        if (struct_atom->slots)
+            mm_free("atom_free: struct_atom->slots", struct_atom->slots);
         mm_free("atom_free: struct_atom", struct_atom);
     }
     else if (atom->type == atom_type_string) {
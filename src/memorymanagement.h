@@ -2,6 +2,8 @@
 #define MEMORYMANAGEMENT_H
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
 
 #include "atom.h"
 
@@ -13,13 +15,36 @@ typedef struct {
     long allocated_bytes;
 } MemoryManagementDebug;
 
+// the scopes whose binds a checkpoint records: imported sources and the prelude's
+#define MM_CHECKPOINT_SCOPES 3
+
+typedef struct {
+    bool taken;
+    AtomListNode *atoms, *mutable_atoms;
+    long name_count;
+    Atom *null_atoms[4];
+    Atom *main_scope, *prelude;
+
+    int scopes_size;
+    Atom *scopes[MM_CHECKPOINT_SCOPES];
+    long scope_sizes[MM_CHECKPOINT_SCOPES];
+
+    // lazy bodies parsed and thunks forced since, which a rollback makes
+    // lazy again (one of each pair is set)
+    struct { FunctionDeclarationAtom *parsed; ThunkAtom *forced; } *lazy;
+    long lazy_size, lazy_capacity;
+} MemoryCheckpoint;
+
 
 void *mm_malloc(const char *msg, size_t n);
 void mm_free(const char *msg, void *ptr);
 
 void mm_prematurely_free_mutable(Atom *atom);
 
+long mm_allocations();
+
 void mm_print_status();
+void mm_print_status_json(FILE *f);
 
 void mm_free_gat();
 void atom_free(Atom *atom);
@@ -28,4 +53,9 @@ void atomlistnode_free(AtomListNode *node);
 
 void memorymanagement_free_all();
 
+void mm_checkpoint();
+bool mm_rollback();
+void mm_checkpoint_parsed(FunctionDeclarationAtom *fd);
+void mm_checkpoint_forced(ThunkAtom *thunk);
+
 #endif
@@ -0,0 +1,1106 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "optimize.h"
+#include "atom.h"
+#include "atomlist.h"
+#include "interpret.h"
+#include "kernel.h"
+#include "parse.h"
+#include "memorymanagement.h"
+#include "debug.h"
+#include "util.h"
+
+#include "context.h"
+
+
+/* Optimization pass (`--O1`, the default)
+
+    Rewrites a parsed program before it is interpreted:
+
+    * primitive applications on constant integer operands are folded, e.g.
+      `+56` becomes `$11.`;
+    * `?`, `|` and `&` on a constant first argument are replaced by the
+      chosen argument, provided the extents of the dropped arguments are
+      known statically;
+    * names bound once by a top-level `!` to a constant are replaced by it
+      in everything following the bind;
+    * declarations which are integer kernels are compiled (see kernel.c);
+    * once a function is first applied, the small functions its body
+      applies are inlined and the subexpressions it repeats are shared, see
+      `optimize_applied`.
+
+    Function bodies are only parsed when first applied (see parse.c) and
+    are optimized then, knowing the binds counted in what encloses them and
+    the constants propagated into them, which are recorded with their
+    declaration (`substitutions`, pairs of name and value) and substituted
+    unless the body binds the name itself. A bind within a body cannot
+    affect what names outside of it refer to, so it is not counted outside;
+    an import within a body is, as the skimming parser noted it.
+
+    Names are only treated as constants if nothing can rebind them: neither
+    `!` nor a function parameter anywhere binds them (`@` is bound by every
+    function) and the program imports nothing but at its top level, where
+    imports never shadow the main scope's names. Atoms following `!`, `\`,
+    `#!` and `#?` are names, not expressions, and those following `,` and
+    `;` are interpreted at a non-zero execution depth; neither is rewritten.
+    Rewrites fold the list in place from right to left, such that operands
+    are already folded when their operator is considered. */
+
+typedef struct {
+    Atom *main;
+    OptimizeScope *enclosing;
+    long *binds;
+    long binds_size;
+    bool imports;
+    bool changed;
+} Optimizer;
+
+
+static bool _is_primitive(Atom *atom, char c) {
+    return atom->type == atom_type_primitive && ((PrimitiveAtom *) atom->atom)->c == c;
+}
+
+
+// count the binds of every name, by symbol id
+static void _count_bind(Optimizer *opt, Atom *name) {
+    long id = ((NameAtom *) name->atom)->id;
+
+    if (id >= opt->binds_size) {
+        long size = opt->binds_size > 0 ? opt->binds_size : 64;
+        while (size <= id)
+            size *= 2;
+
+        long *binds = mm_malloc("optimize: binds", size * sizeof *binds);
+        for (long j = 0; j < size; j++)
+            binds[j] = j < opt->binds_size ? opt->binds[j] : 0;
+
+        if (opt->binds)
+            mm_free("optimize: binds", opt->binds);
+        opt->binds = binds;
+        opt->binds_size = size;
+    }
+
+    opt->binds[id]++;
+}
+
+static void _count_binds(Optimizer *opt, AtomList *lst, bool top) {
+    for (AtomListNode *node = lst->head; node; node = node->next) {
+        Atom *atom = node->atom;
+
+        if (_is_primitive(atom, '!') && node->next && atom_name_is(node->next->atom))
+            _count_bind(opt, node->next->atom);
+
+        else if (_is_primitive(atom, '\\') && !top)
+            opt->imports = true;
+
+        else if (atom_functiondeclaration_is(atom)) {
+            FunctionDeclarationAtom *fd = atom->atom;
+            for (AtomListNode *parameter = fd->parameters->head; parameter; parameter = parameter->next)
+                _count_bind(opt, parameter->atom);
+
+            opt->imports |= fd->imports;
+            _count_binds(opt, fd->body, false);
+        }
+    }
+}
+
+static long _binds(Optimizer *opt, Atom *name) {
+    long id = ((NameAtom *) name->atom)->id;
+    return id < opt->binds_size ? opt->binds[id] : 0;
+}
+
+static bool _never_bound(Optimizer *opt, Atom *name) {
+    long id = ((NameAtom *) name->atom)->id;
+    OptimizeScope *enclosing = opt->enclosing;
+
+    return !opt->imports && _binds(opt, name) == 0
+        && !(enclosing && (enclosing->imports || (id < enclosing->binds_size && enclosing->binds[id] > 0)));
+}
+
+// the main scope's bind of a name nothing else can bind, or NULL; a name the
+// context's prelude binds resolves to that bind, which is not folded
+static Atom *_builtin(Optimizer *opt, Atom *atom) {
+    if (atom->type != atom_type_name || !_never_bound(opt, atom))
+        return NULL;
+    if (GlobContext->prelude && atom_scope_lookup_local(GlobContext->prelude, atom))
+        return NULL;
+
+    return atom_scope_lookup_local(opt->main, atom);
+}
+
+static bool _constant(Optimizer *opt, Atom *atom, integer *value) {
+    if (atom->type != atom_type_integer && !((atom = _builtin(opt, atom)) && atom->type == atom_type_integer))
+        return false;
+
+    *value = ((IntegerAtom *) atom->atom)->value;
+    return true;
+}
+
+static primitive_opcode _primitive(Optimizer *opt, Atom *atom) {
+    Atom *bind = _builtin(opt, atom);
+    if (!bind || bind->type != atom_type_function || !primitive_integer(((FunctionAtom *) bind->atom)->primitive))
+        return primitive_none;
+
+    return ((FunctionAtom *) bind->atom)->primitive;
+}
+
+// whether the atom following `previous` is interpreted as an expression
+static bool _expression_follows(AtomListNode *previous) {
+    if (!previous)
+        return true;
+
+    Atom *atom = previous->atom;
+    return !(_is_primitive(atom, '!') || _is_primitive(atom, '\\')
+        || _is_primitive(atom, ',') || _is_primitive(atom, ';')
+        || _is_primitive(atom, '#' + '!') || _is_primitive(atom, '#' + '?'));
+}
+
+
+/* The node following the expression which starts at `node`; false if its
+   extent is not known statically. */
+static bool _end(Optimizer *opt, AtomListNode *node, AtomListNode **end) {
+    if (!node)
+        return false;
+
+    Atom *atom = node->atom;
+    integer value;
+
+    if (_constant(opt, atom, &value)
+    || atom_functiondeclaration_is(atom)
+    || atom_structinitializer_is(atom))
+        return *end = node->next, true;
+
+    int arguments;
+    if (_primitive(opt, atom) != primitive_none)
+        arguments = 2;
+    else if (_is_primitive(atom, '?'))
+        arguments = 3;
+    else if (_is_primitive(atom, '|') || _is_primitive(atom, '&'))
+        arguments = 2;
+    else if (_is_primitive(atom, '#' + '!') || _is_primitive(atom, '#' + '?')) {
+        if (!node->next)
+            return false;
+        node = node->next;
+        arguments = 1;
+    }
+    else
+        return false;
+
+    for (node = node->next; arguments-- > 0; )
+        if (!_end(opt, node, &node))
+            return false;
+
+    return *end = node, true;
+}
+
+/* Replace the expression [node, end) by its part [keep, keep_end), where
+   keep_end is either end or the known end of the kept part. */
+static void _splice(AtomListNode *node, AtomListNode *keep, AtomListNode *keep_end, AtomListNode *end) {
+    AtomListNode *last = keep;
+    while (keep_end != end && last->next != keep_end)
+        last = last->next;
+
+    for (AtomListNode *n = node->next; n != keep; ) {
+        AtomListNode *next = n->next;
+        atomlistnode_free(n);
+        n = next;
+    }
+    if (keep_end != end)
+        for (AtomListNode *n = keep_end; n != end; ) {
+            AtomListNode *next = n->next;
+            atomlistnode_free(n);
+            n = next;
+        }
+
+    node->atom = keep->atom;
+    if (keep_end == end)
+        node->next = keep->next;
+    else if (keep->next == keep_end)
+        node->next = end;
+    else {
+        node->next = keep->next;
+        last->next = end;
+    }
+
+    atomlistnode_free(keep);
+}
+
+// the node of `value` replacing the expression [node, end)
+static void _replace(Optimizer *opt, AtomListNode *node, AtomListNode *end, integer value) {
+    for (AtomListNode *n = node->next; n != end; ) {
+        AtomListNode *next = n->next;
+        atomlistnode_free(n);
+        n = next;
+    }
+
+    node->atom = atom_integer_new(value);
+    node->next = end;
+    opt->changed = true;
+}
+
+static void _fold_expression(Optimizer *opt, AtomListNode *node) {
+    Atom *atom = node->atom;
+    primitive_opcode primitive = _primitive(opt, atom);
+
+    if (primitive != primitive_none) {
+        AtomListNode *a = node->next, *b = a ? a->next : NULL;
+        integer A, B;
+        if (!b || !_constant(opt, a->atom, &A) || !_constant(opt, b->atom, &B))
+            return;
+
+        // leave division by zero to be reported at runtime
+        if (B == 0 && (primitive == primitive_modulo || primitive == primitive_divide))
+            return;
+
+        _replace(opt, node, b->next, primitive_evaluate(primitive, A, B));
+        return;
+    }
+
+    if (!_is_primitive(atom, '?') && !_is_primitive(atom, '|') && !_is_primitive(atom, '&'))
+        return;
+
+    AtomListNode *first = node->next, *second, *third, *end;
+    integer value;
+    if (!first || !_constant(opt, first->atom, &value) || !(second = first->next))
+        return;
+
+    if (_is_primitive(atom, '?')) {
+        if (!_end(opt, second, &third))
+            return;
+
+        if (value) {
+            if (!_end(opt, third, &end))
+                return;
+            _splice(node, second, third, end);
+        }
+        else {
+            if (!third)
+                return;
+            _splice(node, third, NULL, NULL);
+        }
+    }
+
+    // `|` chooses a non-zero first argument, `&` a zero one
+    else if ((value != 0) == _is_primitive(atom, '|')) {
+        if (!_end(opt, second, &end))
+            return;
+        _splice(node, first, second, end);
+    }
+    else
+        _splice(node, second, NULL, NULL);
+
+    opt->changed = true;
+}
+
+static void _fold(Optimizer *opt, AtomList *lst) {
+    long size = 0;
+    for (AtomListNode *node = lst->head; node; node = node->next)
+        size++;
+
+    if (size == 0)
+        return;
+
+    AtomListNode **nodes = mm_malloc("optimize: nodes", size * sizeof *nodes);
+    long j = 0;
+    for (AtomListNode *node = lst->head; node; node = node->next)
+        nodes[j++] = node;
+
+    // nodes before the one considered are never altered
+    for (j = size-1; j >= 0; j--) {
+        if (atom_functiondeclaration_is(nodes[j]->atom))
+            _fold(opt, ((FunctionDeclarationAtom *) nodes[j]->atom->atom)->body);
+
+        if (_expression_follows(j > 0 ? nodes[j-1] : NULL))
+            _fold_expression(opt, nodes[j]);
+    }
+
+    mm_free("optimize: nodes", nodes);
+}
+
+
+static void _defer_substitution(FunctionDeclarationAtom *fd, Atom *name, Atom *value) {
+    if (!fd->substitutions)
+        fd->substitutions = atomlist_new(NULL);
+
+    for (AtomListNode *node = fd->substitutions->head; node; node = node->next->next)
+        if (node->atom == name)
+            return;
+
+    atomlist_push(fd->substitutions, name);
+    atomlist_push(fd->substitutions, value);
+}
+
+// replace every use of `name` following `previous` by `value`
+static void _substitute(Optimizer *opt, AtomListNode *previous, AtomListNode *node, Atom *name, Atom *value) {
+    for (; node; previous = node, node = node->next) {
+        if (node->atom == name && _expression_follows(previous)) {
+            node->atom = value;
+            opt->changed = true;
+        }
+
+        else if (atom_functiondeclaration_is(node->atom)) {
+            FunctionDeclarationAtom *fd = node->atom->atom;
+            if (fd->lazy)
+                _defer_substitution(fd, name, value);
+            _substitute(opt, NULL, fd->body->head, name, value);
+        }
+    }
+}
+
+/* Top-level statements are followed as long as their extent is known, as
+   up to there every `!` is certain to be executed in order. */
+static void _propagate(Optimizer *opt, AtomList *lst) {
+    // an import within a function may bind any name in its closure
+    if (opt->imports)
+        return;
+
+    Atom *self = atom_name_new(strdup("@"));
+
+    AtomListNode *node = lst->head;
+    while (node) {
+        if (_is_primitive(node->atom, '\\')) {
+            if (!node->next)
+                return;
+            node = node->next->next;
+        }
+
+        else if (_is_primitive(node->atom, '!')) {
+            Atom *name = node->next ? node->next->atom : NULL;
+            AtomListNode *end;
+            if (!name || !atom_name_is(name) || !_end(opt, node->next->next, &end))
+                return;
+
+            integer value;
+            long id = ((NameAtom *) name->atom)->id;
+            if (name != self && id < opt->binds_size && opt->binds[id] == 1
+            && node->next->next->next == end && _constant(opt, node->next->next->atom, &value))
+                _substitute(opt, node->next->next, end, name, atom_integer_new(value));
+
+            node = end;
+        }
+
+        else if (!_end(opt, node, &node))
+            return;
+    }
+}
+
+
+static void _compile_kernels(AtomList *lst) {
+    for (AtomListNode *node = lst->head; node; node = node->next)
+        if (atom_functiondeclaration_is(node->atom)) {
+            FunctionDeclarationAtom *fd = node->atom->atom;
+            _compile_kernels(fd->body);
+
+            if (!fd->kernel && !fd->lazy)
+                fd->kernel = kernel_compile(fd);
+        }
+}
+
+// give the lazy declarations in `lst` what encloses them
+static void _enclose(Optimizer *opt, AtomList *lst, OptimizeScope **scope) {
+    for (AtomListNode *node = lst->head; node; node = node->next) {
+        if (!atom_functiondeclaration_is(node->atom))
+            continue;
+
+        FunctionDeclarationAtom *fd = node->atom->atom;
+        if (!fd->lazy) {
+            _enclose(opt, fd->body, scope);
+            continue;
+        }
+        if (fd->enclosing)
+            continue;
+
+        if (!*scope) {
+            OptimizeScope *enclosing = opt->enclosing;
+            long size = opt->binds_size;
+            if (enclosing && enclosing->binds_size > size)
+                size = enclosing->binds_size;
+
+            *scope = mm_malloc("optimize: scope", sizeof **scope);
+            (*scope)->binds = size > 0 ? mm_malloc("optimize: scope binds", size * sizeof *(*scope)->binds) : NULL;
+            for (long j = 0; j < size; j++)
+                (*scope)->binds[j] = (j < opt->binds_size ? opt->binds[j] : 0)
+                    + (enclosing && j < enclosing->binds_size ? enclosing->binds[j] : 0);
+            (*scope)->binds_size = size;
+            (*scope)->imports = opt->imports || (enclosing && enclosing->imports);
+            (*scope)->references = 0;
+        }
+
+        fd->enclosing = *scope;
+        (*scope)->references++;
+    }
+}
+
+void optimize_scope_release(OptimizeScope *scope) {
+    if (!scope || --scope->references > 0)
+        return;
+
+    if (scope->binds)
+        mm_free("optimize: scope binds", scope->binds);
+    mm_free("optimize: scope", scope);
+}
+
+
+void optimize(AtomList *parsed) {
+    if (GlobOpt.optimization_level < 1 || !atomlist_is(parsed))
+        return;
+
+    Optimizer opt = {
+        .main = main_scope(),
+        .enclosing = NULL,
+        .binds = NULL,
+        .binds_size = 0,
+        .imports = false,
+        .changed = false
+    };
+
+    _count_binds(&opt, parsed, true);
+
+    // propagated constants enable further folds and vice versa
+    for (int j = 0; j < 8; j++) {
+        opt.changed = false;
+        _fold(&opt, parsed);
+        _propagate(&opt, parsed);
+
+        if (!opt.changed)
+            break;
+    }
+
+    OptimizeScope *scope = NULL;
+    _enclose(&opt, parsed, &scope);
+
+    if (opt.binds)
+        mm_free("optimize: binds", opt.binds);
+
+    _compile_kernels(parsed);
+}
+
+/* Bodies of declarations optimized as part of an unoptimized program are
+   left as they are, not knowing what encloses them. */
+void optimize_body(FunctionDeclarationAtom *fd) {
+    if (GlobOpt.optimization_level < 1 || !fd->enclosing)
+        return;
+
+    Optimizer opt = {
+        .main = main_scope(),
+        .enclosing = fd->enclosing,
+        .binds = NULL,
+        .binds_size = 0,
+        .imports = false,
+        .changed = false
+    };
+
+    _count_binds(&opt, fd->body, false);
+    for (AtomListNode *parameter = fd->parameters->head; parameter; parameter = parameter->next)
+        _count_bind(&opt, parameter->atom);
+
+    if (fd->substitutions)
+        for (AtomListNode *node = fd->substitutions->head; node; node = node->next->next)
+            if (_binds(&opt, node->atom) == 0)
+                _substitute(&opt, NULL, fd->body->head, node->atom, node->next->atom);
+
+    _fold(&opt, fd->body);
+
+    OptimizeScope *scope = NULL;
+    _enclose(&opt, fd->body, &scope);
+
+    if (opt.binds)
+        mm_free("optimize: binds", opt.binds);
+
+    _compile_kernels(fd->body);
+    if (!fd->kernel)
+        fd->kernel = kernel_compile(fd);
+}
+
+
+// 1 for a parameter of a function, 2 for a name its body binds, else 0
+static int _bound_within(FunctionDeclarationAtom *fd, Atom *name) {
+    for (AtomListNode *parameter = fd->parameters->head; parameter; parameter = parameter->next)
+        if (parameter->atom == name)
+            return 1;
+
+    for (AtomListNode *node = fd->body->head; node && node->next; node = node->next)
+        if (_is_primitive(node->atom, '!') && node->next->atom == name)
+            return 2;
+
+    return 0;
+}
+
+// what the scope binds a name to, thunks being looked up unforced; or NULL
+static Atom *_closure_bind(Atom *scope, Atom *name) {
+    Atom *bind = NULL;
+    for (; !bind && atom_scope_is(scope); scope = ((ScopeAtom *) scope->atom)->upper_scope)
+        bind = atom_scope_lookup_local(scope, name);
+
+    return bind;
+}
+
+// the arity a bind is applied with, -1 if it is not
+static int _applied_arity(Atom *bind) {
+    if (bind->type == atom_type_function)
+        return ((FunctionAtom *) bind->atom)->arity;
+    if (bind->type == atom_type_structinitializer)
+        return ((StructInitializerAtom *) bind->atom)->arity;
+    return -1;
+}
+
+
+/* Inlined applications
+
+    When a function is first applied, the applications in its body of small
+    functions its closure binds are inlined. A callee of at most INLINE_SIZE
+    atoms forming one expression, which neither refers to itself, binds,
+    imports, changes the execution depth nor declares a function, has its
+    body expanded at the application, each parameter replaced by its
+    argument. An argument is an integer, a name bound to data or an
+    expression of integer primitives; the latter is evaluated where its
+    parameter occurs, which thus has to be exactly once, outside of the
+    branches of `?`, `|` and `&` and after the parameters before it. Names
+    the callee refers to are kept if the caller's scope binds them alike and
+    replaced by their binds otherwise, such that the expansion means in the
+    caller's scope what the body means in the callee's. Callees compiled to
+    a kernel are left to be applied as such.
+
+    An inlined application is preceded by an inline atom holding the
+    expansion and guards, which record what each name the expansion relies
+    on was bound to; while they hold, the expansion is interpreted instead
+    of the application (see interpret.c). */
+
+#define INLINE_SIZE 8
+#define INLINE_GUARDS 8
+
+typedef struct {
+    FunctionDeclarationAtom *fd;
+    Atom *scope;
+    InlineGuard guards[INLINE_GUARDS];
+    int guards_size;
+} Inliner;
+
+typedef struct {
+    FunctionDeclarationAtom *fd;
+    Atom *scope, *function;
+    Atom *body[INLINE_SIZE], *binds[INLINE_SIZE];
+    int size;
+    // per parameter: occurrences, whether one is within a branch, the
+    // order of its first occurrence
+    int uses[INLINE_SIZE], conditional[INLINE_SIZE], order[INLINE_SIZE];
+    int orders;
+} Callee;
+
+static bool _guard(Inliner *in, Atom *scope, Atom *name, Atom *bind) {
+    for (int j = 0; j < in->guards_size; j++)
+        if (in->guards[j].scope == scope && in->guards[j].name == name)
+            return in->guards[j].bind == bind;
+
+    if (in->guards_size >= INLINE_GUARDS)
+        return false;
+
+    in->guards[in->guards_size++] = (InlineGuard) { .scope = scope, .name = name, .bind = bind };
+    return true;
+}
+
+// the caller's bind of a name not bound within it, or NULL
+static Atom *_caller_bind(Inliner *in, Atom *name) {
+    return _bound_within(in->fd, name) == 0 ? atom_scope_lookup(in->scope, name) : NULL;
+}
+
+// a single atom argument: an integer, or a name bound to data
+static bool _inline_simple(Inliner *in, Atom *atom) {
+    if (atom->type == atom_type_integer)
+        return true;
+    if (atom->type != atom_type_name)
+        return false;
+
+    Atom *bind;
+    if (_bound_within(in->fd, atom) != 1 && !((bind = _caller_bind(in, atom)) && _applied_arity(bind) == -1))
+        return false;
+
+    return _guard(in, NULL, atom, NULL);
+}
+
+// the end of an argument of integer primitives starting at `node`
+static bool _inline_integer(Inliner *in, AtomListNode *node, AtomListNode **end) {
+    if (!node)
+        return false;
+
+    if (_inline_simple(in, node->atom))
+        return *end = node->next, true;
+
+    int arguments = 2;
+    Atom *bind;
+    if (_is_primitive(node->atom, '#' + '?')) {
+        if (!node->next || !atom_name_is(node->next->atom))
+            return false;
+        node = node->next;
+        arguments = 1;
+    }
+    else if (!(node->atom->type == atom_type_name && (bind = _caller_bind(in, node->atom))
+    && bind->type == atom_type_function && primitive_integer(((FunctionAtom *) bind->atom)->primitive)
+    && _guard(in, NULL, node->atom, bind)))
+        return false;
+
+    for (node = node->next; arguments-- > 0; )
+        if (!_inline_integer(in, node, &node))
+            return false;
+
+    return *end = node, true;
+}
+
+// the end of the callee's expression starting at `j`, or -1
+static int _callee_end(Callee *c, int j, bool conditional) {
+    if (j >= c->size)
+        return -1;
+
+    Atom *atom = c->body[j++];
+    int arguments = 0, unconditional = 0;
+
+    if (atom->type == atom_type_name) {
+        int k = 0;
+        AtomListNode *parameter = c->fd->parameters->head;
+        while (parameter && parameter->atom != atom)
+            parameter = parameter->next, k++;
+
+        if (parameter) {
+            if (c->uses[k]++ == 0)
+                c->order[k] = c->orders++;
+            c->conditional[k] |= conditional;
+            return j;
+        }
+
+        Atom *bind = atom_scope_lookup(c->scope, atom);
+        if (!bind || bind == c->function)
+            return -1;
+
+        c->binds[j-1] = bind;
+        arguments = unconditional = _applied_arity(bind) > 0 ? _applied_arity(bind) : 0;
+    }
+    else if (_is_primitive(atom, '?'))
+        arguments = 3, unconditional = 1;
+    else if (_is_primitive(atom, '|') || _is_primitive(atom, '&'))
+        arguments = 2, unconditional = 1;
+    else if (_is_primitive(atom, '#' + '!') || _is_primitive(atom, '#' + '?')) {
+        if (j >= c->size || !atom_name_is(c->body[j++]))
+            return -1;
+        arguments = unconditional = 1;
+    }
+    else if (atom->type != atom_type_integer && atom->type != atom_type_structinitializer)
+        return -1;
+
+    for (int k = 0; k < arguments && j != -1; k++)
+        j = _callee_end(c, j, conditional || k >= unconditional);
+
+    return j;
+}
+
+// a function the caller may inline, its body read into `c`
+static bool _inline_callee(Callee *c, Atom *function) {
+    if (function->type != atom_type_function || !((FunctionAtom *) function->atom)->declaration)
+        return false;
+
+    FunctionAtom *function_atom = function->atom;
+    FunctionDeclarationAtom *fd = function_atom->declaration;
+    if (fd->arity > INLINE_SIZE)
+        return false;
+
+    // parse the callee's body without reporting what its application would
+    if (fd->lazy) {
+        bool ERR = GlobOpt.ERR, WRN = GlobOpt.WRN;
+        long errors = ErrorCount;
+        GlobOpt.ERR = GlobOpt.WRN = false;
+        bool parsed = parse_body(fd);
+        GlobOpt.ERR = ERR, GlobOpt.WRN = WRN;
+        ErrorCount = errors;
+
+        if (parsed && !fd->body->head)
+            fd->lazy = true;
+        if (fd->lazy)
+            return false;
+    }
+
+    // a kernel's application is cheaper than interpreting its expansion
+    if (fd->kernel)
+        return false;
+
+    *c = (Callee) { .fd = fd, .scope = function_atom->scope, .function = function, .size = 0, .orders = 0 };
+    for (AtomListNode *node = fd->body->head; node; node = node->next) {
+        // the expressions shared, inlined and unboxed atoms precede are left to be
+        if (node->atom->type == atom_type_shared || node->atom->type == atom_type_inline
+        || node->atom->type == atom_type_unboxed)
+            continue;
+        if (c->size >= INLINE_SIZE)
+            return false;
+        c->binds[c->size] = NULL;
+        c->body[c->size++] = node->atom;
+    }
+
+    return c->size > 0 && _callee_end(c, 0, false) == c->size;
+}
+
+// inline the application starting at `node`, if it can be
+static bool _inline_application(Inliner *in, AtomListNode *node) {
+    Atom *function = _caller_bind(in, node->atom);
+    Callee c;
+    if (!function || !_inline_callee(&c, function))
+        return false;
+
+    in->guards_size = 0;
+    if (!_guard(in, NULL, node->atom, function))
+        return false;
+
+    // the arguments, each either a single atom or an expression
+    AtomListNode *starts[INLINE_SIZE], *ends[INLINE_SIZE];
+    AtomListNode *end = node->next;
+    int previous = -1;
+    for (int k = 0; k < c.fd->arity; k++) {
+        starts[k] = end;
+        if (!_inline_integer(in, starts[k], &end))
+            return false;
+        ends[k] = end;
+
+        if (ends[k] != starts[k]->next) {
+            if (c.uses[k] != 1 || c.conditional[k] || c.order[k] < previous)
+                return false;
+            previous = c.order[k];
+        }
+    }
+
+    AtomList *expansion = atomlist_new(NULL);
+    AtomListNode **tail = &expansion->head;
+    for (int j = 0; j < c.size; j++) {
+        Atom *atom = c.body[j], *bind = c.binds[j];
+        bool field = j > 0 && (_is_primitive(c.body[j-1], '#' + '!') || _is_primitive(c.body[j-1], '#' + '?'));
+
+        int k = 0;
+        AtomListNode *parameter = c.fd->parameters->head;
+        while (atom->type == atom_type_name && parameter && parameter->atom != atom)
+            parameter = parameter->next, k++;
+
+        if (atom->type == atom_type_name && parameter && !field)
+            for (AtomListNode *argument = starts[k]; argument != ends[k]; argument = argument->next)
+                tail = atomlist_append(tail, argument->atom);
+
+        else if (!bind)
+            tail = atomlist_append(tail, atom);
+
+        // kept if alike in the caller, else replaced by the callee's bind
+        else if (_caller_bind(in, atom) == bind && _guard(in, NULL, atom, bind))
+            tail = atomlist_append(tail, atom);
+
+        else if ((bind->type == atom_type_integer || bind->type == atom_type_struct || _applied_arity(bind) != -1)
+        && _guard(in, c.scope, atom, bind)) {
+            if (_applied_arity(bind) != -1)
+                tail = atomlist_append(tail, atom_primitive_new(','));
+            tail = atomlist_append(tail, bind);
+        }
+
+        else
+            return atomlist_free(expansion), false;
+    }
+
+    AtomListNode *next = node->next;
+    atomlist_append(&node->next, node->atom);
+    node->next->next = next;
+    node->atom = atom_inline_new(expansion, in->guards, in->guards_size, end);
+
+    return true;
+}
+
+// the number of applications inlined
+static int _inline(FunctionDeclarationAtom *fd, Atom *scope) {
+    Inliner in = { .fd = fd, .scope = scope, .guards_size = 0 };
+    int inlined = 0;
+
+    AtomListNode *previous = NULL;
+    for (AtomListNode *node = fd->body->head; node; previous = node, node = node->next)
+        if (node->atom->type == atom_type_name && _expression_follows(previous) && _inline_application(&in, node)) {
+            inlined++;
+            node = node->next;
+        }
+
+    return inlined;
+}
+
+
+/* Shared subexpressions
+
+    When a function is first applied, the arities of what its body's names
+    refer to are known: its closure binds them, its parameters are taken to
+    be data and names the body binds itself are not known. Every expression
+    whose extent thus is, which applies a function other than an integer
+    primitive and which neither binds, imports, changes the execution depth
+    nor declares a function, is a candidate; of those occurring more than
+    once, the longest are chosen first, occurrences not overlapping one
+    another. Each chosen occurrence is preceded by a shared atom, which
+    interprets the first occurrence evaluated within an application and
+    skips the others, reusing its value (see interpret.c). */
+
+typedef struct {
+    Atom *scope;
+    FunctionDeclarationAtom *fd;
+    AtomListNode **nodes;
+    long size;
+    long *ends;
+    bool *applies;
+} Sharer;
+
+#define SHARE_UNKNOWN (-2)
+#define SHARE_DATA (-1)
+
+// the arity a name is applied with, SHARE_DATA or SHARE_UNKNOWN
+static int _share_arity(Sharer *s, Atom *name, bool *applies) {
+    int within = _bound_within(s->fd, name);
+    if (within != 0)
+        return within == 1 ? SHARE_DATA : SHARE_UNKNOWN;
+
+    // closures are not created
+    Atom *bind = _closure_bind(s->scope, name);
+    if (!bind)
+        return SHARE_UNKNOWN;
+
+    if (bind->type == atom_type_thunk)
+        return *applies = true, ((FunctionDeclarationAtom *) ((ThunkAtom *) bind->atom)->declaration->atom)->arity;
+
+    if (bind->type == atom_type_function) {
+        FunctionAtom *function_atom = bind->atom;
+        *applies |= !primitive_integer(function_atom->primitive);
+        return function_atom->arity;
+    }
+
+    if (bind->type == atom_type_structinitializer)
+        return ((StructInitializerAtom *) bind->atom)->arity;
+
+    return SHARE_DATA;
+}
+
+// the index following the expression starting at index `start`, or -1
+static long _share_end(Sharer *s, long start) {
+    if (start >= s->size)
+        return -1;
+    if (s->ends[start] != SHARE_UNKNOWN)
+        return s->ends[start];
+
+    Atom *atom = s->nodes[start]->atom;
+    long j = start+1;
+    bool applies = false;
+    int arguments;
+
+    // an inlined application is interpreted as the one it precedes
+    if (atom->type == atom_type_inline)
+        arguments = 1, applies = true;
+    else if (atom->type == atom_type_name)
+        arguments = _share_arity(s, atom, &applies);
+    else if (_is_primitive(atom, '?'))
+        arguments = 3;
+    else if (_is_primitive(atom, '|') || _is_primitive(atom, '&'))
+        arguments = 2;
+    else if (_is_primitive(atom, '#' + '!') || _is_primitive(atom, '#' + '?'))
+        arguments = j < s->size && atom_name_is(s->nodes[j++]->atom) ? 1 : SHARE_UNKNOWN;
+    else if (atom->type == atom_type_primitive || atom_functiondeclaration_is(atom))
+        arguments = SHARE_UNKNOWN;
+    else
+        arguments = SHARE_DATA;
+
+    for (int k = 0; k < arguments && j != -1; k++) {
+        long argument = j;
+        if ((j = _share_end(s, argument)) != -1)
+            applies |= s->applies[argument];
+    }
+
+    s->ends[start] = arguments == SHARE_UNKNOWN ? -1 : j;
+    s->applies[start] = applies;
+    return s->ends[start];
+}
+
+// inlined applications are alike if the applications they precede are
+static bool _share_equal(Sharer *s, long a, long b, long length) {
+    for (long k = 0; k < length; k++) {
+        Atom *atomA = s->nodes[a+k]->atom, *atomB = s->nodes[b+k]->atom;
+        if (atomA != atomB && !(atomA->type == atom_type_inline && atomB->type == atom_type_inline))
+            return false;
+    }
+    return true;
+}
+
+// the number of evaluations sharing saves at most per application
+static int _share(FunctionDeclarationAtom *fd, Atom *scope) {
+    Sharer s = { .scope = scope, .fd = fd, .size = 0 };
+    for (AtomListNode *node = fd->body->head; node; node = node->next)
+        s.size++;
+
+    s.nodes = mm_malloc("optimize: share nodes", s.size * sizeof *s.nodes);
+    s.ends = mm_malloc("optimize: share ends", s.size * sizeof *s.ends);
+    s.applies = mm_malloc("optimize: share applies", s.size * sizeof *s.applies);
+    // indices of candidates, by decreasing length; whether an index is taken
+    long *candidates = mm_malloc("optimize: share candidates", s.size * sizeof *candidates);
+    bool *taken = mm_malloc("optimize: share taken", s.size * sizeof *taken);
+
+    long j = 0;
+    for (AtomListNode *node = fd->body->head; node; node = node->next, j++) {
+        s.nodes[j] = node;
+        s.ends[j] = SHARE_UNKNOWN;
+        s.applies[j] = false;
+        taken[j] = false;
+    }
+
+    long candidates_size = 0;
+    for (j = 0; j < s.size; j++)
+        if (_expression_follows(j > 0 ? s.nodes[j-1] : NULL) && _share_end(&s, j) != -1 && s.applies[j])
+            candidates[candidates_size++] = j;
+
+    // insertion sort, bodies being short
+    for (long k = 1; k < candidates_size; k++)
+        for (long l = k; l > 0 && s.ends[candidates[l]] - candidates[l] > s.ends[candidates[l-1]] - candidates[l-1]; l--) {
+            long t = candidates[l];
+            candidates[l] = candidates[l-1];
+            candidates[l-1] = t;
+        }
+
+    // starts of the chosen occurrences
+    long *chosen = mm_malloc("optimize: share chosen", s.size * sizeof *chosen);
+    long chosen_size = 0;
+    int shared = 0, saved = 0;
+
+    for (long k = 0; k < candidates_size; k++) {
+        long a = candidates[k], length = s.ends[a] - a;
+        if (taken[a])
+            continue;
+
+        long first = chosen_size;
+        for (long l = k; l < candidates_size; l++) {
+            long b = candidates[l];
+            if (s.ends[b] - b != length)
+                break;
+            if (!_share_equal(&s, a, b, length))
+                continue;
+
+            bool clear = true;
+            for (long m = b; m < b + length && clear; m++)
+                clear = !taken[m];
+            if (!clear)
+                continue;
+
+            for (long m = b; m < b + length; m++)
+                taken[m] = true;
+            chosen[chosen_size++] = b;
+        }
+
+        // a single occurrence is left as it is
+        if (chosen_size - first < 2) {
+            for (long l = first; l < chosen_size; l++)
+                for (long m = chosen[l]; m < chosen[l] + length; m++)
+                    taken[m] = false;
+            chosen_size = first;
+            continue;
+        }
+
+        for (long l = first; l < chosen_size; l++) {
+            AtomListNode *node = s.nodes[chosen[l]];
+            AtomListNode *end = s.ends[chosen[l]] < s.size ? s.nodes[s.ends[chosen[l]]] : NULL;
+
+            AtomListNode *next = node->next;
+            atomlist_append(&node->next, node->atom);
+            node->next->next = next;
+            node->atom = atom_shared_new(shared, end);
+        }
+
+        shared++;
+        saved += chosen_size - first - 1;
+    }
+
+    fd->shared = shared;
+
+    mm_free("optimize: share chosen", chosen);
+    mm_free("optimize: share taken", taken);
+    mm_free("optimize: share candidates", candidates);
+    mm_free("optimize: share applies", s.applies);
+    mm_free("optimize: share ends", s.ends);
+    mm_free("optimize: share nodes", s.nodes);
+    return saved;
+}
+
+
+/* Unboxed subexpressions
+
+    Once the small functions a body applies are inlined and the
+    subexpressions it repeats shared, each outermost expression of integer
+    primitives, `?`, `|` and `&` nesting at least two of them is compiled to
+    a kernel of its own (see kernel.c), such that a function which is no
+    kernel as a whole still evaluates its arithmetic on unboxed integers.
+    The names such an expression refers to are typed by what binds them:
+    the closure's binds have to be integers or the main scope's primitives
+    already, while the body's parameters and binds are checked to be
+    integers whenever the expression is evaluated. The expression is
+    preceded by an unboxed atom, which evaluates the kernel instead of
+    interpreting it, boxing only its value, unless a check fails or the
+    kernel bails out (see interpret.c). */
+
+#define UNBOX_DEPTH 2
+
+// whether what the closure binds lets a kernel's names be what it needs
+static bool _unbox_typed(FunctionDeclarationAtom *fd, Atom *scope, Kernel *kernel) {
+    for (int j = 0; j < kernel->names_size; j++) {
+        Atom *bind = _closure_bind(scope, kernel->names[j]);
+        if (_bound_within(fd, kernel->names[j]) != 0 || !bind || !kernel_same_bind(bind, kernel->binds[j]))
+            return false;
+    }
+
+    for (int j = 0; j < kernel->captures_size; j++) {
+        Atom *bind = _closure_bind(scope, kernel->captures[j]);
+        if (_bound_within(fd, kernel->captures[j]) == 0 && !(bind && bind->type == atom_type_integer))
+            return false;
+    }
+
+    return true;
+}
+
+// the number of subexpressions unboxed
+static int _unbox(FunctionDeclarationAtom *fd, Atom *scope) {
+    int unboxed = 0;
+
+    AtomListNode *previous = NULL;
+    for (AtomListNode *node = fd->body->head; node; previous = node, node = node->next) {
+        AtomListNode *end;
+        Kernel *kernel = _expression_follows(previous) ? kernel_compile_subexpression(node, &end) : NULL;
+        if (!kernel)
+            continue;
+        if (kernel->depth < UNBOX_DEPTH || !_unbox_typed(fd, scope, kernel)) {
+            kernel_free(kernel);
+            continue;
+        }
+
+        AtomListNode *next = node->next;
+        atomlist_append(&node->next, node->atom);
+        node->next->next = next;
+        node->atom = atom_unboxed_new(kernel, end);
+        unboxed++;
+
+        // what the expression nests is evaluated by its kernel
+        while (node->next != end)
+            node = node->next;
+    }
+
+    return unboxed;
+}
+
+
+/* A body is optimized further when its function is first applied, knowing
+   what its closure binds: the small functions it applies are inlined, the
+   subexpressions it repeats shared and its integer expressions unboxed. */
+void optimize_applied(FunctionDeclarationAtom *fd, Atom *scope) {
+    fd->shared = 0;
+    if (GlobOpt.optimization_level < 1 || fd->kernel || !fd->body->head)
+        return;
+
+    int inlined = _inline(fd, scope);
+    int saved = _share(fd, scope);
+    int unboxed = _unbox(fd, scope);
+
+    // a rollback returns the body to be parsed anew, freeing the atoms added
+    if (inlined > 0 || fd->shared > 0 || unboxed > 0) {
+        mm_checkpoint_parsed(fd);
+        info("optimize :: Inlined %d applications, shared %d subexpressions and unboxed %d of a function body, saving up to %d evaluations per application.\n",
+            inlined, fd->shared, unboxed, saved);
+    }
+}
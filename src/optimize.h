@@ -0,0 +1,27 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "atomlist.h"
+#include "atom.h"
+
+
+/* The binds counted in, and whether there are imports within, what
+   encloses the lazy declarations of one optimized program or body, which
+   share it. */
+struct OptimizeScope { long *binds; long binds_size; bool imports; long references; };
+
+/* The version of the atoms parsing and optimizing a source yields, which
+   cached sources are stored as (see cache.c); to be bumped whenever
+   parse.c, optimize.c or the atoms they produce change what a program is
+   parsed into. */
+#define OPTIMIZE_VERSION 1
+
+void optimize(AtomList *parsed);
+
+// optimize a lazy declaration's body once it is parsed
+void optimize_body(FunctionDeclarationAtom *fd);
+void optimize_scope_release(OptimizeScope *scope);
+// optimize a body when its function is first applied, closed over `scope`
+void optimize_applied(FunctionDeclarationAtom *fd, Atom *scope);
+
+#endif
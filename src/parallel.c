@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parallel.h"
+#include "atom.h"
+#include "atomlist.h"
+#include "interpret.h"
+#include "memorymanagement.h"
+#include "debug.h"
+
+#include "context.h"
+
+
+/* Parallel list combinators
+
+    `[pmap]fl`, `[pfilter]pl` and `[preduce]fal` evaluate like `[map]`,
+    `[filter]` and `[foldl]` of stdlib/list.krrp, `[preduce]` assuming its
+    function to be associative. Their applications are spread over `--jobs`
+    worker processes: the interpreter's atom tables, allocator and counters
+    are global to the process, so a worker is a fork of the interpreter
+    sharing nothing with it but a counter from which workers claim chunks of
+    the list (such that fast workers take over what slow ones leave). Each
+    chunk's results are sent back through a pipe, serialized by value, and
+    the parent reassembles them in list order; `[preduce]` folds every chunk
+    within its worker and the chunks' results within the parent.
+
+    The parent interprets applications for the first `PARALLEL_PROBE`
+    seconds; lists whose remaining applications are then estimated to take
+    less than `PARALLEL_GRAIN` seconds are interpreted sequentially. So are
+    chunks a worker did not finish, as an application reported an error or
+    returned anything but integers, strings and structs of those; the parent
+    then reports errors as a sequential evaluation would. Profiles and
+    traces are only taken of sequential evaluation. */
+
+#define PARALLEL_PROBE 0.001
+#define PARALLEL_GRAIN 0.005
+#define PARALLEL_CHUNKS 4
+
+#define ASSERT(cnd, ...) { if (!(cnd)) return error("parallel :: " __VA_ARGS__), atom_Enull_new(); }
+
+typedef struct {
+    primitive_opcode primitive;
+    Atom *function;
+    Atom **elements;
+    long size, first;
+    long recursion_depth;
+} Combination;
+
+
+static double parallel_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static Atom *parallel_apply1(Combination *c, Atom *x) {
+    return interpret_apply(c->function, &x, 1, c->recursion_depth);
+}
+
+static Atom *parallel_apply2(Combination *c, Atom *x, Atom *y) {
+    Atom *arguments[] = { x, y };
+    return interpret_apply(c->function, arguments, 2, c->recursion_depth);
+}
+
+// `[preduce]`'s result for elements [from, to) if non-empty
+static Atom *parallel_fold(Combination *c, Atom *accumulator, long from, long to) {
+    for (long j = from; j < to; j++)
+        accumulator = accumulator ? parallel_apply2(c, accumulator, c->elements[j]) : c->elements[j];
+
+    return accumulator;
+}
+
+
+/* Values are sent as a tag followed by an integer (`i`), a string (`s`) or
+   a struct's type and fields (`t`); strings are prefixed by their length. */
+typedef struct { char *data; long size, capacity; } Buffer;
+
+static void buffer_write(Buffer *b, const void *data, long size) {
+    if (b->size + size > b->capacity) {
+        long capacity = 2 * (b->size + size);
+        char *grown = mm_malloc("parallel: buffer", capacity);
+        if (b->data) {
+            memcpy(grown, b->data, b->size);
+            mm_free("parallel: buffer", b->data);
+        }
+        b->data = grown;
+        b->capacity = capacity;
+    }
+
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+}
+
+static void buffer_write_long(Buffer *b, long value) { buffer_write(b, &value, sizeof value); }
+
+static void buffer_write_string(Buffer *b, const char *str) {
+    long length = strlen(str);
+    buffer_write_long(b, length);
+    buffer_write(b, str, length);
+}
+
+static bool buffer_write_atom(Buffer *b, Atom *atom) {
+    if (atom_integer_is(atom)) {
+        buffer_write(b, "i", 1);
+        buffer_write_long(b, ((IntegerAtom *) atom->atom)->value);
+        return true;
+    }
+
+    if (atom_string_is(atom)) {
+        buffer_write(b, "s", 1);
+        buffer_write_string(b, ((StringAtom *) atom->atom)->str);
+        return true;
+    }
+
+    if (atom_struct_is(atom)) {
+        StructAtom *struct_atom = atom->atom;
+        StructInitializerAtom *shape = struct_atom->shape->atom;
+        if (!atom_name_is(shape->type))
+            return false;
+
+        buffer_write(b, "t", 1);
+        buffer_write_string(b, ((NameAtom *) shape->type->atom)->name);
+        buffer_write_long(b, shape->size);
+        for (int j = 0; j < shape->size; j++) {
+            buffer_write_string(b, ((NameAtom *) shape->layout[j]->atom)->name);
+            if (!buffer_write_atom(b, struct_atom->slots[j]))
+                return false;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+typedef struct { const char *data; long position, size; } Reader;
+
+static bool reader_read(Reader *r, void *data, long size) {
+    if (size < 0 || r->position + size > r->size)
+        return false;
+
+    memcpy(data, r->data + r->position, size);
+    r->position += size;
+    return true;
+}
+
+static char *reader_read_string(Reader *r) {
+    long length;
+    if (!reader_read(r, &length, sizeof length) || length < 0 || r->position + length > r->size)
+        return NULL;
+
+    char *str = mm_malloc("parallel: string", length + 1);
+    reader_read(r, str, length);
+    str[length] = '\0';
+    return str;
+}
+
+static Atom *reader_read_atom(Reader *r) {
+    char tag;
+    if (!reader_read(r, &tag, 1))
+        return NULL;
+
+    if (tag == 'i') {
+        integer value;
+        return reader_read(r, &value, sizeof value) ? atom_integer_new(value) : NULL;
+    }
+
+    if (tag == 's') {
+        char *str = reader_read_string(r);
+        return str ? atom_string_new(str) : NULL;
+    }
+
+    long size;
+    char *type = tag == 't' ? reader_read_string(r) : NULL;
+    if (!type)
+        return NULL;
+    if (!reader_read(r, &size, sizeof size) || size < 0) {
+        mm_free("parallel: string", type);
+        return NULL;
+    }
+
+    AtomList *fields = atomlist_new(NULL);
+    Atom **slots = size > 0 ? mm_malloc("interpret: slots", size * sizeof *slots) : NULL;
+    for (long j = 0; j < size; j++) {
+        char *field = reader_read_string(r);
+        slots[j] = field ? reader_read_atom(r) : NULL;
+        if (field)
+            atomlist_push(fields, atom_name_new(field));
+
+        if (!slots[j]) {
+            mm_free("parallel: string", type);
+            atomlist_free(fields);
+            mm_free("interpret: slots", slots);
+            return NULL;
+        }
+    }
+
+    return atom_struct_new(atom_structinitializer_new(atom_name_new(type), fields), slots);
+}
+
+
+#if defined(__unix__)
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+static long parallel_jobs() {
+    return GlobOpt.jobs > 0 ? GlobOpt.jobs : sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+/* A worker claims chunks of `chunk` elements following the first ones,
+   writing a record (its length, the chunk and the chunk's results) per
+   finished chunk; it stops at the first chunk it cannot finish. */
+static void parallel_worker(Combination *c, long *next, long chunk, int fd) {
+    GlobOpt.ERR = GlobOpt.WRN = GlobOpt.INF = false;
+
+    for (;;) {
+        long k = __atomic_fetch_add(next, 1, __ATOMIC_RELAXED);
+        long from = c->first + k*chunk, to = from + chunk < c->size ? from + chunk : c->size;
+        if (from >= c->size)
+            return;
+
+        long errors = ErrorCount;
+        Buffer b = { .data = NULL, .size = 0, .capacity = 0 };
+        buffer_write_long(&b, 0);
+        buffer_write_long(&b, k);
+
+        bool ok = true;
+        if (c->primitive == primitive_preduce)
+            ok = buffer_write_atom(&b, parallel_fold(c, NULL, from, to));
+        else
+            for (long j = from; ok && j < to; j++)
+                ok = buffer_write_atom(&b, parallel_apply1(c, c->elements[j]));
+
+        if (!ok || ErrorCount != errors) {
+            mm_free("parallel: buffer", b.data);
+            return;
+        }
+
+        long length = b.size - sizeof length;
+        memcpy(b.data, &length, sizeof length);
+        for (long written = 0, w; written < b.size; written += w)
+            if ((w = write(fd, b.data + written, b.size - written)) <= 0)
+                return;
+        mm_free("parallel: buffer", b.data);
+    }
+}
+
+/* Interpret the chunks following the first elements in worker processes;
+   `results` receives the results of every chunk finished, indexed by
+   element or, for `[preduce]`, by the chunk's first element. */
+static void parallel_workers(Combination *c, long workers, long chunk, Atom **results, bool *finished) {
+    long *next = mmap(NULL, sizeof *next, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (next == MAP_FAILED)
+        return;
+    *next = 0;
+
+    struct pollfd fds[workers];
+    Buffer buffers[workers];
+    pid_t pids[workers];
+    long spawned = 0;
+
+    fflush(stdout);
+    fflush(stderr);
+    for (; spawned < workers; spawned++) {
+        int pipefd[2];
+        if (pipe(pipefd) != 0)
+            break;
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(pipefd[0]);
+            close(pipefd[1]);
+            break;
+        }
+
+        if (pid == 0) {
+            close(pipefd[0]);
+            parallel_worker(c, next, chunk, pipefd[1]);
+            _exit(EXIT_SUCCESS);
+        }
+
+        close(pipefd[1]);
+        pids[spawned] = pid;
+        fds[spawned] = (struct pollfd) { .fd = pipefd[0], .events = POLLIN };
+        buffers[spawned] = (Buffer) { .data = NULL, .size = 0, .capacity = 0 };
+    }
+
+    // read from every worker until all of them are done
+    for (long open = spawned; open > 0; ) {
+        if (poll(fds, spawned, -1) < 0)
+            break;
+
+        for (long w = 0; w < spawned; w++) {
+            if (fds[w].fd < 0 || !fds[w].revents)
+                continue;
+
+            char data[4096];
+            ssize_t n = read(fds[w].fd, data, sizeof data);
+            if (n > 0)
+                buffer_write(&buffers[w], data, n);
+            else {
+                close(fds[w].fd);
+                fds[w].fd = -1;
+                open--;
+            }
+        }
+    }
+
+    for (long w = 0; w < spawned; w++) {
+        if (fds[w].fd >= 0)
+            close(fds[w].fd);
+        waitpid(pids[w], NULL, 0);
+
+        Reader r = { .data = buffers[w].data, .position = 0, .size = buffers[w].size };
+        long length, k;
+        while (reader_read(&r, &length, sizeof length) && length >= 0 && r.position + length <= r.size) {
+            long end = r.position + length;
+            if (!reader_read(&r, &k, sizeof k) || k < 0 || c->first + k*chunk >= c->size)
+                break;
+
+            long from = c->first + k*chunk, to = from + chunk < c->size ? from + chunk : c->size;
+            bool ok = true;
+            if (c->primitive == primitive_preduce)
+                ok = !!(results[from] = reader_read_atom(&r));
+            else
+                for (long j = from; ok && j < to; j++)
+                    ok = !!(results[j] = reader_read_atom(&r));
+
+            finished[k] = ok;
+            r.position = end;
+        }
+
+        if (buffers[w].data)
+            mm_free("parallel: buffer", buffers[w].data);
+    }
+
+    munmap(next, sizeof *next);
+}
+
+#else
+
+static long parallel_jobs() {
+    return 1;
+}
+
+static void parallel_workers(Combination *c, long workers, long chunk, Atom **results, bool *finished) {
+}
+
+#endif
+
+
+Atom *parallel_apply(primitive_opcode primitive, Atom **arguments, long recursion_depth) {
+    const char *symbol = primitive_symbol(primitive);
+    int arity = primitive == primitive_preduce ? 2 : 1;
+    Atom *function = arguments[0];
+    Atom *list = arguments[arity];
+
+    ASSERT(atom_function_is(function) && ((FunctionAtom *) function->atom)->arity == arity,
+        "%s expected a function of %d argument%s, got %s.\n", symbol, arity, arity > 1 ? "s" : "", atom_repr(function))
+
+    // gather the elements, `L`s holding an element `f` and the rest `r`
+    Atom *E = atom_name_new(strdup("E")), *f = atom_name_new(strdup("f")), *r = atom_name_new(strdup("r"));
+    Atom *shape = NULL;
+    Combination c = {
+        .primitive = primitive,
+        .function = function,
+        .elements = NULL,
+        .size = 0,
+        .first = 0,
+        .recursion_depth = recursion_depth
+    };
+
+    long capacity = 0;
+    for (; atom_struct_is(list) && atom_struct_type(list) != E; list = atom_struct_field(list, r)) {
+        shape = ((StructAtom *) list->atom)->shape;
+        ASSERT(((StructInitializerAtom *) shape->atom)->size == 2 && atom_struct_field(list, f) && atom_struct_field(list, r),
+            "%s expected a list, got %s.\n", symbol, atom_repr(list))
+
+        if (c.size >= capacity) {
+            capacity = capacity > 0 ? 2 * capacity : 64;
+            Atom **elements = mm_malloc("parallel: elements", capacity * sizeof *elements);
+            for (long j = 0; j < c.size; j++)
+                elements[j] = c.elements[j];
+            if (c.elements)
+                mm_free("parallel: elements", c.elements);
+            c.elements = elements;
+        }
+
+        c.elements[c.size++] = atom_struct_field(list, f);
+    }
+
+    if (!atom_struct_is(list)) {
+        if (c.elements)
+            mm_free("parallel: elements", c.elements);
+        ASSERT(false, "%s expected a list, got %s.\n", symbol, atom_repr(list))
+    }
+
+    Atom *accumulator = primitive == primitive_preduce ? arguments[1] : NULL;
+    Atom **results = c.size > 0 ? mm_malloc("parallel: results", c.size * sizeof *results) : NULL;
+
+    // time a first few applications to decide whether forking pays off
+    double start = parallel_now(), elapsed = 0;
+    while (c.first < c.size && (elapsed = parallel_now() - start) < PARALLEL_PROBE) {
+        if (primitive == primitive_preduce)
+            accumulator = parallel_apply2(&c, accumulator, c.elements[c.first]);
+        else
+            results[c.first] = parallel_apply1(&c, c.elements[c.first]);
+        c.first++;
+    }
+
+    long rest = c.size - c.first, workers = 0, chunk = rest > 0 ? rest : 1;
+    long jobs = parallel_jobs();
+    if (jobs > 1 && rest > 1 && elapsed / c.first * rest >= PARALLEL_GRAIN && !GlobOpt.profile && !GlobOpt.trace) {
+        workers = jobs < rest ? jobs : rest;
+        chunk = (rest + workers*PARALLEL_CHUNKS-1) / (workers*PARALLEL_CHUNKS);
+    }
+
+    long chunks = (rest + chunk-1) / chunk;
+    bool *finished = chunks > 0 ? mm_malloc("parallel: finished", chunks * sizeof *finished) : NULL;
+    for (long k = 0; k < chunks; k++)
+        finished[k] = false;
+
+    if (workers > 0) {
+        info("%s: %ld elements over %ld workers in chunks of %ld.\n", symbol, c.size, workers, chunk);
+        parallel_workers(&c, workers, chunk, results, finished);
+    }
+
+    // combine the chunks in order, interpreting those left over
+    for (long k = 0; k < chunks; k++) {
+        long from = c.first + k*chunk, to = from + chunk < c.size ? from + chunk : c.size;
+
+        if (primitive == primitive_preduce)
+            accumulator = finished[k] ? parallel_apply2(&c, accumulator, results[from])
+                : parallel_fold(&c, accumulator, from, to);
+        else if (!finished[k])
+            for (long j = from; j < to; j++)
+                results[j] = parallel_apply1(&c, c.elements[j]);
+    }
+
+    Atom *ret = accumulator;
+    if (primitive != primitive_preduce) {
+        ret = list;
+        for (long j = c.size-1; j >= 0; j--) {
+            if (primitive == primitive_pfilter) {
+                if (!atom_integer_is(results[j])) {
+                    error("parallel :: %s expected an integer predicate, got %s.\n", symbol, atom_repr(results[j]));
+                    ret = atom_Enull_new();
+                    break;
+                }
+                if (!((IntegerAtom *) results[j]->atom)->value)
+                    continue;
+            }
+
+            Atom **slots = mm_malloc("interpret: slots", 2 * sizeof *slots);
+            slots[atom_structinitializer_slot(shape, f)] = primitive == primitive_pmap ? results[j] : c.elements[j];
+            slots[atom_structinitializer_slot(shape, r)] = ret;
+            ret = atom_struct_new(shape, slots);
+        }
+    }
+
+    if (c.elements)
+        mm_free("parallel: elements", c.elements);
+    if (results)
+        mm_free("parallel: results", results);
+    if (finished)
+        mm_free("parallel: finished", finished);
+
+    return ret;
+}
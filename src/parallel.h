@@ -0,0 +1,12 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "atom.h"
+
+
+// the combinators take at most this many arguments
+#define PARALLEL_ARITY 3
+
+Atom *parallel_apply(primitive_opcode primitive, Atom **arguments, long recursion_depth);
+
+#endif
@@ -5,6 +5,7 @@
 #include "atom.h"
 #include "debug.h"
 #include "memorymanagement.h"
+#include "optimize.h"
 
 /* === Grammar ===
 
@@ -37,6 +38,12 @@
     [...]  : character class
     [^...] : complemented character class
 
+    A function declaration's body is only bracket-matched when it is parsed,
+    finding the `.` terminating it; the body itself is parsed and optimized
+    when the function is first applied (`parse_body`), such that functions
+    which are never applied cost little more than their source. Syntax
+    errors within a body are thus reported when it is first applied.
+
 */
 
 static int _parse(const char *source, int p, AtomList *parsed, parse_state state);
@@ -86,13 +93,16 @@ static void print_escaped(const char *source, int p) {
     fprintf(stderr, "\n");
 }
 
+// the offending source is only printed along with a diagnostic shown
 static void error_parse(const char *source, int p, const char *err) {
-    print_escaped(source, p);
+    if (GlobOpt.ERR)
+        print_escaped(source, p);
     error("ParseError :: %s\n", err);
 }
 
 static void warning_parse(const char *source, int p, const char *wrn) {
-    print_escaped(source, p);
+    if (GlobOpt.WRN)
+        print_escaped(source, p);
     warning("ParseWarning :: %s\n", wrn);
 }
 
@@ -110,6 +120,60 @@ static int parse_comment(const char *source, int p) {
     return p;
 }
 
+typedef struct { bool binds, imports; } Skim;
+
+/* Find the `terminator` ending what starts at `p` only by matching brackets,
+   noting in `skim` (unless NULL) whether it binds, imports or declares a
+   function outside of any declaration and whether it imports at all. */
+static int skip(const char *source, int p, char terminator, Skim *skim) {
+    for (char c; (c = source[p]); p++) {
+        if (c == terminator)
+            return p;
+
+        else if (c == ':')
+            return error_parse(source, p, "skip: Stray ':' in function declaration body or struct fields."), -1;
+        else if (c == '.')
+            return error_parse(source, p, "skip: Stray '.' in function declaration parameters."), -1;
+
+        else if (c == '[' || c == '$') {
+            char end = c == '[' ? ']' : '.';
+            while (source[p] && source[p] != end)
+                p++;
+            if (!source[p])
+                return error_parse(source, p, "skip: Unfinished name or literal."), -1;
+        }
+
+        else if (c == '~')
+            p = parse_comment(source, p);
+
+        else if (c == '#' && (source[p+1] == '!' || source[p+1] == '?'))
+            p++;
+
+        else if (c == '#')
+            p = skip(source, p+1, '.', NULL);
+
+        else if (c == '^') {
+            Skim nested = { .binds = false, .imports = false };
+            p = skip(source, p+1, ':', NULL);
+            if (p != -1)
+                p = skip(source, p+1, '.', &nested);
+
+            if (skim)
+                skim->binds = true, skim->imports |= nested.imports;
+        }
+
+        else if ((c == '!' || c == '\\') && skim) {
+            skim->binds = true;
+            skim->imports |= c == '\\';
+        }
+
+        if (p == -1)
+            return -1;
+    }
+
+    return error_parse(source, p, "skip: Unterminated."), -1;
+}
+
 static int parse_functiondeclaration(const char *source, int p, AtomList *parsed) {
     if (source[p] != '^')
         return error_parse(source, p, "parse_functiondeclaration: Attempting to parse non-function-declaration."), -1;
@@ -140,28 +204,45 @@ static int parse_functiondeclaration(const char *source, int p, AtomList *parsed
     if (!parameters->head)
         warning_parse(source, s, "parse_functiondeclaration: Function declaration without parameters.");
 
-    // parse body
-    AtomList *body = atomlist_new(NULL);
-    #undef RETURN
-    #define RETURN return atomlist_free(parameters), atomlist_free(body),
-    p = _parse(source, ++p, body, parse_state_functiondeclaration_body);
+    // skip body
+    int b = p+1;
+    Skim skim = { .binds = false, .imports = false };
+    p = skip(source, b, '.', &skim);
 
     if (p == -1)
-        RETURN error_parse(source, s, "parse_functiondeclaration: Could not parse function declaration body."), -1;
+        RETURN error_parse(source, s, "parse_functiondeclaration: Function declaration body unfinished."), -1;
 
-    if (source[p] != '.')
-        RETURN error_parse(source, p, "parse_functiondeclaration: Function declaration body unfinished."), -1;
-
-    if (!body->head)
-        warning_parse(source, s, "parse_functiondeclaration: Function declaration without body.");
+    char *body = mm_malloc("parse_functiondeclaration", (p-b+2) * sizeof *body);
+    for (int j = 0; j <= p-b; j++)
+        body[j] = source[b+j];
+    body[p-b+1] = '\0';
 
     // assemble function declaration
-    atomlist_push(parsed, atom_functiondeclaration_new(atomlist_len(parameters), parameters, body));
+    atomlist_push(parsed, atom_functiondeclaration_new(atomlist_len(parameters), parameters, body, skim.binds, skim.imports));
 
     #undef RETURN
     return p;
 }
 
+bool parse_body(FunctionDeclarationAtom *fd) {
+    if (!fd->lazy)
+        return true;
+
+    if (_parse(fd->source, 0, fd->body, parse_state_functiondeclaration_body) == -1) {
+        while (!atomlist_empty(fd->body))
+            atomlist_pop_front(fd->body);
+        return error_parse(fd->source, -1, "parse_body: Could not parse function declaration body."), false;
+    }
+
+    if (!fd->body->head)
+        warning_parse(fd->source, 0, "parse_body: Function declaration without body.");
+
+    fd->lazy = false;
+    mm_checkpoint_parsed(fd);
+    optimize_body(fd);
+    return true;
+}
+
 static int parse_structinitializer(const char *source, int p, AtomList *parsed) {
     if (source[p] != '#')
         return error_parse(source, p, "parse_structinitializer: Attempting to parse non-struct-declaration."), -1;
@@ -14,4 +14,7 @@ typedef enum {
 
 AtomList *parse(const char *source);
 
+// parse and optimize a lazy body; false if it cannot be parsed
+bool parse_body(FunctionDeclarationAtom *fd);
+
 #endif
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "profile.h"
+#include "atom.h"
+#include "atomlist.h"
+#include "memorymanagement.h"
+#include "debug.h"
+
+
+/* Function-level profiler (`--profile`)
+
+    User functions are identified by their body, which every function created
+    from one declaration shares; the first name such a function is bound to
+    by `!` names it. Calls are recorded in a trie of call paths, from which
+    both the per-function report and the collapsed stacks for flame-graph
+    tools are derived. The profiler's own bookkeeping uses plain `malloc` so
+    as not to show up in the allocation counts it measures; names point into
+    interned name atoms, so reports have to be written before those are
+    freed. */
+
+typedef struct ProfileName ProfileName;
+struct ProfileName { AtomList *body; const char *name; char *generated; ProfileName *next; };
+
+typedef struct ProfileNode ProfileNode;
+struct ProfileNode {
+    AtomList *body;
+    ProfileNode *parent, *children, *next;
+
+    long calls;
+    double inclusive, exclusive;
+    long inclusive_allocations, exclusive_allocations;
+};
+
+typedef struct { ProfileNode *node; double start, children; long allocations, children_allocations; } ProfileFrame;
+
+typedef struct {
+    AtomList *body;
+    const char *name;
+    long calls;
+    double inclusive, exclusive;
+    long inclusive_allocations, exclusive_allocations;
+} ProfileEntry;
+
+
+struct ProfileState {
+    ProfileName *names;
+    ProfileNode root;
+    ProfileFrame *stack;
+    long stack_size, stack_capacity;
+    double start;
+    long anonymous;
+};
+
+
+static double profile_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *profile_malloc(size_t n) {
+    void *ptr = calloc(1, n);
+    if (!ptr) {
+        error("profile :: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+// the context's profiler, allocated on first use
+static ProfileState *profile_state() {
+    if (!GlobContext->profile)
+        GlobContext->profile = profile_malloc(sizeof *GlobContext->profile);
+    return GlobContext->profile;
+}
+
+#define Names (profile_state()->names)
+#define Root (profile_state()->root)
+#define Stack (profile_state()->stack)
+#define StackSize (profile_state()->stack_size)
+#define StackCapacity (profile_state()->stack_capacity)
+#define Start (profile_state()->start)
+
+
+void profile_start() {
+    Start = profile_now();
+}
+
+void profile_name(AtomList *body, Atom *name) {
+    for (ProfileName *n = Names; n; n = n->next)
+        if (n->body == body)
+            return;
+
+    ProfileName *n = profile_malloc(sizeof *n);
+    n->body = body;
+    n->name = ((NameAtom *) name->atom)->name;
+    n->next = Names;
+    Names = n;
+}
+
+void profile_enter(AtomList *body) {
+    ProfileNode *parent = StackSize > 0 ? Stack[StackSize-1].node : &Root;
+
+    // children are kept in most-recently-entered order
+    ProfileNode **link = &parent->children, *node;
+    while ((node = *link) && node->body != body)
+        link = &node->next;
+
+    if (node)
+        *link = node->next;
+    else {
+        node = profile_malloc(sizeof *node);
+        node->body = body;
+        node->parent = parent;
+    }
+    node->next = parent->children;
+    parent->children = node;
+
+    if (StackSize >= StackCapacity) {
+        StackCapacity = StackCapacity > 0 ? 2*StackCapacity : 64;
+        Stack = realloc(Stack, StackCapacity * sizeof *Stack);
+        if (!Stack) {
+            error("profile :: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    Stack[StackSize++] = (ProfileFrame) {
+        .node = node,
+        .start = profile_now(),
+        .children = 0,
+        .allocations = mm_allocations(),
+        .children_allocations = 0
+    };
+}
+
+void profile_exit() {
+    if (StackSize <= 0) {
+        error("profile :: Function exit without matching entry.\n");
+        return;
+    }
+
+    ProfileFrame *frame = &Stack[--StackSize];
+    double elapsed = profile_now() - frame->start;
+    long allocations = mm_allocations() - frame->allocations;
+
+    ProfileNode *node = frame->node;
+    node->calls++;
+    node->inclusive += elapsed;
+    node->exclusive += elapsed - frame->children;
+    node->inclusive_allocations += allocations;
+    node->exclusive_allocations += allocations - frame->children_allocations;
+
+    if (StackSize > 0) {
+        Stack[StackSize-1].children += elapsed;
+        Stack[StackSize-1].children_allocations += allocations;
+    }
+}
+
+
+// functions never bound to a name are numbered in the order they are reported
+const char *profile_function_name(AtomList *body) {
+    for (ProfileName *n = Names; n; n = n->next)
+        if (n->body == body)
+            return n->name;
+
+    ProfileName *n = profile_malloc(sizeof *n);
+    n->body = body;
+    n->generated = profile_malloc(32);
+    snprintf(n->generated, 32, "[anonymous %ld]", ++profile_state()->anonymous);
+    n->name = n->generated;
+    n->next = Names;
+    Names = n;
+
+    return n->name;
+}
+
+static bool profile_on_path(ProfileNode *node) {
+    for (ProfileNode *p = node->parent; p; p = p->parent)
+        if (p->body == node->body)
+            return true;
+
+    return false;
+}
+
+/* Functions are aggregated over all their call paths; inclusive measures of
+   recursive calls are only counted at the outermost call. */
+static void profile_aggregate(ProfileNode *node, ProfileEntry **entries, long *size, long *capacity) {
+    for (ProfileNode *child = node->children; child; child = child->next) {
+        long j = 0;
+        while (j < *size && (*entries)[j].body != child->body)
+            j++;
+
+        if (j >= *size) {
+            if (*size >= *capacity) {
+                *capacity = *capacity > 0 ? 2 * *capacity : 64;
+                *entries = realloc(*entries, *capacity * sizeof **entries);
+                if (!*entries) {
+                    error("profile :: Out of memory.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            (*entries)[(*size)++] = (ProfileEntry) { .body = child->body, .name = profile_function_name(child->body) };
+        }
+
+        ProfileEntry *entry = &(*entries)[j];
+        entry->calls += child->calls;
+        entry->exclusive += child->exclusive;
+        entry->exclusive_allocations += child->exclusive_allocations;
+        if (!profile_on_path(child)) {
+            entry->inclusive += child->inclusive;
+            entry->inclusive_allocations += child->inclusive_allocations;
+        }
+
+        profile_aggregate(child, entries, size, capacity);
+    }
+}
+
+static int profile_compare(const void *a, const void *b) {
+    double x = ((const ProfileEntry *) a)->exclusive, y = ((const ProfileEntry *) b)->exclusive;
+    return (x < y) - (x > y);
+}
+
+void profile_report(FILE *f) {
+    double total = profile_now() - Start;
+
+    ProfileEntry *entries = NULL;
+    long size = 0, capacity = 0;
+    profile_aggregate(&Root, &entries, &size, &capacity);
+    qsort(entries, size, sizeof *entries, profile_compare);
+
+    fprintf(f, "=== Profile (%.3f ms total) ===\n", 1000 * total);
+    fprintf(f, "%10s %12s %7s %12s %7s %12s %12s  %s\n",
+        "calls", "incl ms", "incl %", "excl ms", "excl %", "incl allocs", "excl allocs", "function");
+
+    for (long j = 0; j < size; j++) {
+        ProfileEntry *e = &entries[j];
+        fprintf(f, "%10ld %12.3f %6.1f%% %12.3f %6.1f%% %12ld %12ld  %s\n",
+            e->calls,
+            1000 * e->inclusive, total > 0 ? 100 * e->inclusive / total : 0,
+            1000 * e->exclusive, total > 0 ? 100 * e->exclusive / total : 0,
+            e->inclusive_allocations, e->exclusive_allocations,
+            e->name);
+    }
+
+    free(entries);
+}
+
+
+/* One line per call path, `[main];f;g <exclusive microseconds>`, as consumed
+   by flamegraph.pl and compatible tools. */
+static void profile_write_path(FILE *f, ProfileNode *node) {
+    if (node == &Root) {
+        fprintf(f, "[main]");
+        return;
+    }
+
+    profile_write_path(f, node->parent);
+    fprintf(f, ";%s", profile_function_name(node->body));
+}
+
+static void profile_write_node(FILE *f, ProfileNode *node) {
+    long weight = (long) (1e6 * node->exclusive + .5);
+    if (node != &Root && weight > 0) {
+        profile_write_path(f, node);
+        fprintf(f, " %ld\n", weight);
+    }
+
+    for (ProfileNode *child = node->children; child; child = child->next)
+        profile_write_node(f, child);
+}
+
+bool profile_write_collapsed(const char *filename) {
+    FILE *f = fopen(filename, "w");
+    if (!f)
+        return error("profile :: Could not open `%s` for writing.\n", filename), false;
+
+    profile_write_node(f, &Root);
+    return fclose(f) == 0;
+}
+
+
+static void profile_free_node(ProfileNode *node) {
+    ProfileNode *child = node->children;
+    while (child) {
+        ProfileNode *next = child->next;
+        profile_free_node(child);
+        free(child);
+        child = next;
+    }
+}
+
+void profile_free() {
+    if (!GlobContext->profile)
+        return;
+
+    profile_free_node(&Root);
+    Root.children = NULL;
+
+    while (Names) {
+        ProfileName *next = Names->next;
+        free(Names->generated);
+        free(Names);
+        Names = next;
+    }
+
+    free(Stack);
+    free(GlobContext->profile);
+    GlobContext->profile = NULL;
+}
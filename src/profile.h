@@ -0,0 +1,21 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "atom.h"
+#include "atomlist.h"
+
+
+void profile_start();
+void profile_name(AtomList *body, Atom *name);
+void profile_enter(AtomList *body);
+void profile_exit();
+const char *profile_function_name(AtomList *body);
+
+void profile_report(FILE *f);
+bool profile_write_collapsed(const char *filename);
+void profile_free();
+
+#endif
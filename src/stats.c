@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <signal.h>
+
+#include "stats.h"
+#include "debug.h"
+
+
+/* Interpreter runtime statistics (`--stats`)
+
+    Counters are only updated when `--stats` is given; they are printed as
+    JSON on exit and, on SIGUSR1, at the next interpreted atom. */
+
+volatile sig_atomic_t StatsSnapshotRequested = 0;
+
+
+static void stats_signal_handler(int signal) {
+    StatsSnapshotRequested = 1;
+}
+
+void stats_install_signal_handler() {
+    struct sigaction action = { .sa_handler = stats_signal_handler };
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+
+    if (sigaction(SIGUSR1, &action, NULL) != 0)
+        warning("stats :: Could not install SIGUSR1 handler.\n");
+}
+
+void stats_snapshot() {
+    StatsSnapshotRequested = 0;
+    stats_print_json(stderr);
+    fflush(stderr);
+}
+
+
+static const char *stats_interned_types[STATS_ATOM_TYPES] = {
+    [atom_type_name] = "name",
+    [atom_type_integer] = "integer",
+    [atom_type_primitive] = "primitive",
+    [atom_type_scope] = "scope",
+    [atom_type_structinitializer] = "structinitializer",
+    [atom_type_struct] = "struct",
+    [atom_type_string] = "string"
+};
+
+void stats_print_json(FILE *f) {
+    Stats *s = &GlobStats;
+
+    fprintf(f, "{\"tokens\": %ld, ", s->tokens);
+    fprintf(f, "\"applications\": {\"primitive\": %ld, \"user\": %ld, \"struct_initializer\": %ld, \"inlined\": %ld}, ",
+        s->primitive_applications, s->user_applications, s->struct_initializations, s->inlined_applications);
+    fprintf(f, "\"evaluations_saved\": %ld, \"evaluations_unboxed\": %ld, ", s->shared_evaluations, s->unboxed_evaluations);
+    fprintf(f, "\"scope_lookups\": %ld, \"scope_links_walked\": %ld, ", s->scope_lookups, s->scope_links);
+
+    fprintf(f, "\"intern\": {");
+    const char *separator = "";
+    for (int type = 0; type < STATS_ATOM_TYPES; type++) {
+        if (!stats_interned_types[type])
+            continue;
+
+        fprintf(f, "%s\"%s\": {\"lookups\": %ld, \"probes\": %ld, \"hits\": %ld}", separator, stats_interned_types[type],
+            s->intern_lookups[type], s->intern_probes[type], s->intern_lookups[type] - s->intern_misses[type]);
+        separator = ", ";
+    }
+    fprintf(f, "}, ");
+
+    fprintf(f, "\"atomlist_copies\": %ld, \"atomlist_copied_nodes\": %ld, ", s->atomlist_copies, s->atomlist_copied_nodes);
+    fprintf(f, "\"imports\": %ld, ", s->imports);
+    fprintf(f, "\"cache\": {\"hits\": %ld, \"misses\": %ld}, ", s->cache_hits, s->cache_misses);
+    fprintf(f, "\"maximum_recursion_depth\": %ld}\n", s->maximum_recursion_depth);
+}
@@ -0,0 +1,34 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <signal.h>
+
+#include "typedefs.h"
+
+
+#define STATS_ATOM_TYPES (atom_type_list+1)
+
+typedef struct {
+    long tokens;
+    long primitive_applications, user_applications, struct_initializations, inlined_applications;
+    long shared_evaluations, unboxed_evaluations;
+    long scope_lookups, scope_links;
+    long intern_lookups[STATS_ATOM_TYPES], intern_probes[STATS_ATOM_TYPES], intern_misses[STATS_ATOM_TYPES];
+    long atomlist_copies, atomlist_copied_nodes;
+    long imports;
+    long cache_hits, cache_misses;
+    long maximum_recursion_depth;
+} Stats;
+
+extern volatile sig_atomic_t StatsSnapshotRequested;
+
+// STAT(counter += n) only touches the counters when `--stats` is given
+#define STAT(...) ((void) (GlobOpt.stats && ((GlobStats.__VA_ARGS__), true)))
+
+void stats_install_signal_handler();
+void stats_snapshot();
+void stats_print_json(FILE *f);
+
+#endif
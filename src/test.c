@@ -1,5 +1,9 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <dirent.h>
 
 #include "atom.h"
 #include "util.h"
@@ -7,6 +11,11 @@
 #include "interpret.h"
 #include "memorymanagement.h"
 #include "debug.h"
+#include "optimize.h"
+#include "kernel.h"
+#include "libkrrp.h"
+
+#include "context.h"
 
 
 void test(const char *source, Atom *expected) {
@@ -14,14 +23,380 @@ void test(const char *source, Atom *expected) {
 
     info("Testing '%s'\n", esource);
 
+    // interpret both as parsed and as optimized
+    int optimization_level = GlobOpt.optimization_level;
+
+    GlobOpt.optimization_level = 0;
     Atom *computed = interpret(parse(source));
 
+    GlobOpt.optimization_level = 1;
+    AtomList *parsed = parse(source);
+    optimize(parsed);
+    Atom *optimized = interpret(parsed);
+
+    GlobOpt.optimization_level = optimization_level;
+
     if (!atom_equal(computed, expected))
         error("[FAIL] \"%s\"\n   :: '%s' differs from expected '%s'.\n", esource, atom_repr(computed), atom_repr(expected));
+    if (!atom_equal(optimized, computed))
+        error("[FAIL] \"%s\"\n   :: Optimized '%s' differs from unoptimized '%s'.\n", esource, atom_repr(optimized), atom_repr(computed));
 
     mm_free("test", esource);
 }
 
+// the kernel compiled from a source's first declaration, or NULL
+Kernel *test_compile_kernel(const char *source) {
+    AtomList *parsed = parse(source);
+    optimize(parsed);
+
+    for (AtomListNode *node = parsed ? parsed->head : NULL; node; node = node->next)
+        if (atom_functiondeclaration_is(node->atom)) {
+            FunctionDeclarationAtom *fd = node->atom->atom;
+            return parse_body(fd) ? fd->kernel : NULL;
+        }
+    return NULL;
+}
+
+// the signature of that kernel
+void test_kernel(const char *source, const char *expected) {
+    Kernel *kernel = test_compile_kernel(source);
+    char *signature = kernel ? kernel_signature(kernel) : NULL;
+    if (signature ? !expected || strcmp(signature, expected) != 0 : expected != NULL)
+        error("[FAIL] Kernel of \"%s\"\n   :: '%s' differs from expected '%s'.\n", source,
+            signature ? signature : "none", expected ? expected : "none");
+
+    if (signature)
+        mm_free("kernel: signature", signature);
+}
+
+// a kernel capturing a name unbound where it is applied is not applied, the
+// interpreter reporting the name instead
+void test_kernel_unbound() {
+    Kernel *kernel = test_compile_kernel("!k^n:+nm.");
+    Atom *argument = atom_integer_new(3);
+    integer value;
+    long errors = ErrorCount;
+
+    if (!kernel || kernel_apply(kernel, main_scope(), 0, &argument, &value) || ErrorCount != errors)
+        error("[FAIL] Kernel of \"!k^n:+nm.\"\n   :: Applying it without m bound did not fall back silently.\n");
+}
+
+// bodies are parsed when first applied, so unapplied ones may not even parse
+void test_lazy() {
+    AtomList *parsed = parse("![g]^n:#S,.. ![f]^n:*nn. [f]3");
+    optimize(parsed);
+
+    FunctionDeclarationAtom *fds[2];
+    int size = 0;
+    for (AtomListNode *node = parsed ? parsed->head : NULL; node; node = node->next)
+        if (atom_functiondeclaration_is(node->atom) && size < 2)
+            fds[size++] = node->atom->atom;
+
+    Atom *computed = size == 2 ? interpret(parsed) : NULL;
+    if (!computed || !atom_equal(computed, atom_integer_new(9)) || !fds[0]->lazy || fds[1]->lazy || !fds[1]->kernel)
+        error("[FAIL] Lazy bodies\n   :: '%s' differs from expected '9' or the wrong bodies were parsed.\n",
+            computed ? atom_repr(computed) : "none");
+}
+
+// a repeated struct field keeps its first value, as a rebind would
+void test_struct_fields() {
+    krrp_context *ctx = krrp_context_new();
+    krrp_options(ctx)->ERR = false;
+    krrp_options(ctx)->WRN = false;
+    char *output = krrp_eval(ctx, "!P#Paba. !p P 1 2 3 #!a p #!b p p P 4 5 6");
+
+    if (!output || strcmp(output, "1\n2\nP12\nP45\n") != 0 || krrp_errors(ctx) != 2)
+        error("[FAIL] Struct fields\n   :: '%s' with %ld errors differs from expected '1\\n2\\nP12\\nP45\\n' with 2.\n",
+            output ? output : "none", krrp_errors(ctx));
+    free(output);
+    krrp_context_free(ctx);
+}
+
+// the bytes a source's parse diagnostics write to stderr
+static long test_parse_stderr(const char *source, bool shown) {
+    fflush(stderr);
+    int saved = dup(2);
+    FILE *captured = tmpfile();
+    dup2(fileno(captured), 2);
+
+    krrp_context *ctx = krrp_context_new();
+    krrp_options(ctx)->ERR = krrp_options(ctx)->WRN = shown;
+    free(krrp_eval(ctx, source));
+    krrp_context_free(ctx);
+
+    fflush(stderr);
+    dup2(saved, 2);
+    close(saved);
+    long size = ftell(captured);
+    fclose(captured);
+    return size;
+}
+
+// parse diagnostics, the offending source included, print only if shown
+void test_parse_quiet() {
+    const char *sources[] = { "!P#Paa. P12", "![f]^x:+x" };
+    for (unsigned j = 0; j < sizeof sources / sizeof *sources; j++)
+        if (test_parse_stderr(sources[j], false) != 0 || test_parse_stderr(sources[j], true) == 0)
+            error("[FAIL] Parse diagnostics \"%s\"\n   :: Were printed although hidden, or not printed although shown.\n", sources[j]);
+}
+
+/* Interpret a source in a context of its own, comparing its output, the
+   errors it reported and the `Stats` counter at offset `counter` with the
+   expected ones. */
+static void test_counted(const char *source, const char *expected, long errors, size_t counter, long count) {
+    krrp_context *ctx = krrp_context_new();
+    krrp_options(ctx)->ERR = false;
+    krrp_options(ctx)->stats = true;
+    char *output = krrp_eval(ctx, source);
+    long counted = *(long *) ((char *) &ctx->stats + counter);
+
+    if (!output || strcmp(output, expected) != 0 || krrp_errors(ctx) != errors || counted != count)
+        error("[FAIL] \"%s\"\n   :: '%s' with %ld errors and a count of %ld differs from expected with %ld and %ld.\n",
+            source, output ? output : "none", krrp_errors(ctx), counted, errors, count);
+    free(output);
+    krrp_context_free(ctx);
+}
+
+// a repeated subexpression is evaluated once per application, unless that
+// reported an error or its extent was not the one assumed
+void test_share() {
+    size_t saved = offsetof(Stats, shared_evaluations);
+    test_counted("![sq]^n:*nn. ![f]^n:+[sq]n[sq]n. [f]7 [f]8", "$98.\n$128.\n", 0, saved, 2);
+    test_counted("![sq]^n:*nn. ![f]^n:?<n0 0 +[sq][sq]n[sq][sq]n. [f]3", "$162.\n", 0, saved, 1);
+    test_counted("![d]^n:/1n. ![f]^n:+[d]n[d]n. [f]0", "0\n", 2, saved, 0);
+    test_counted("![h]^n:*n2. ![f]^gx:+[h]gx[h]gx. ![i]^n:+n1. f;i3", "$16.\n", 0, saved, 0);
+}
+
+// applications of small functions are inlined while their guards hold
+void test_inline() {
+    size_t inlined = offsetof(Stats, inlined_applications);
+    test_counted("\\T ![g]^t:+[fst]t[snd]t. ![f]^t:[g]t. [f]T3 4 [f]T5 6", "7\n$11.\n", 0, inlined, 2);
+    test_counted("\\T !kT3 4 ![g]^x:+x[fst]k. ![f]^k:[g]k. [f]$10.", "$13.\n", 0, inlined, 1);
+    test_counted("\\T ![g]^x:+x[fst]x. ![f]^x:[g]x. [f]T1 2", "ENull\n", 1, inlined, 1);
+    test_counted("![h]^n:*n2. ![f]^gx:[h]gx. ![i]^n:+n1. f;i3", "8\n", 0, inlined, 0);
+    test_counted("![big]^ab:+++*ab*ab*ab*ab. ![f]^x:[big]x2. [f]3", "$24.\n", 0, inlined, 0);
+}
+
+// the integer expressions of a function which is no kernel as a whole are
+// evaluated unboxed while their names are bound to integers and primitives
+void test_unbox() {
+    size_t unboxed = offsetof(Stats, unboxed_evaluations);
+    test_counted("\\T ![f]^tn:+[fst]t*+nn n. [f]T1 2 3 [f]T1 2 4", "$19.\n$33.\n", 0, unboxed, 2);
+    test_counted("\\T ![f]^tn:+[fst]t*+nn n. [f]T1 2 T3 4", "ENull\n", 3, unboxed, 0);
+    test_counted("\\T ![f]^tn:+[fst]t*/n0 n. [f]T1 2 3", "1\n", 1, unboxed, 0);
+    test_counted("!*^ab:-ab. \\T ![f]^tn:+[fst]t*+nn n. [f]T1 2 3", "4\n", 0, unboxed, 0);
+    test_counted("\\L !N#Nlv. ![w]^tn:?#?Et n @#!lt %+*nn+*3n7$1009.. [w]N N E 5 2 1", "$161.\n", 0, unboxed, 2);
+}
+
+// a list evaluates alike with and without worker processes, even where
+// applications fail; the lists are long enough to be spread over workers
+void test_parallel() {
+    const char *sources[] = {
+        "\\M \\L [sum][pmap]^n:[length][filter];[prime?][range]0+n$150..[range]0$40.",
+        "\\M \\L [pmap]^n:?=n$38. /1 0 [length][filter];[prime?][range]0+n$150..[range]0$40.",
+        "\\M \\L [pfilter]^n:?=n$38. /1 0 [length][filter];[prime?][range]0+n$150..[range]0$40.",
+        "\\M \\L [preduce]^ab:?=b$1000. /1 0 ++ab*0[length][filter];[prime?][range]0$150..0[append][range]0$39.L$1000.E",
+        "\\M \\L [preduce]^ab:+a1.0[pmap]^n:?=n$38. ^x:x. [length][filter];[prime?][range]0+n$150..[range]0$40."
+    };
+    long jobs[] = { 1, 4 };
+
+    for (unsigned j = 0; j < sizeof sources / sizeof *sources; j++) {
+        char *outputs[2];
+        long errors[2];
+        for (int k = 0; k < 2; k++) {
+            krrp_context *ctx = krrp_context_new();
+            krrp_options(ctx)->ERR = false;
+            krrp_options(ctx)->jobs = jobs[k];
+            outputs[k] = krrp_eval(ctx, sources[j]);
+            errors[k] = krrp_errors(ctx);
+            krrp_context_free(ctx);
+        }
+
+        if (!outputs[0] || !outputs[1] || strcmp(outputs[0], outputs[1]) != 0 || errors[0] != errors[1])
+            error("[FAIL] Parallel \"%s\"\n   :: '%s' with %ld errors using one job differs from '%s' with %ld using four.\n",
+                sources[j], outputs[0] ? outputs[0] : "none", errors[0], outputs[1] ? outputs[1] : "none", errors[1]);
+        free(outputs[0]);
+        free(outputs[1]);
+    }
+}
+
+// a second context interprets, imports and counts errors on its own
+void test_context() {
+    long errors = ErrorCount;
+
+    krrp_context *ctx = krrp_context_new();
+    krrp_options(ctx)->ERR = false;
+    krrp_import(ctx, "N", "![sq]^n:*nn.\n![cube]^n:*n[sq]n.\n");
+    char *output = krrp_eval(ctx, "\\N [cube]3 /10");
+
+    if (!output || strcmp(output, "$27.\n0\n") != 0 || krrp_errors(ctx) != 1)
+        error("[FAIL] Context\n   :: '%s' with %ld errors differs from expected '$27.\\n0\\n' with 1.\n",
+            output ? output : "none", krrp_errors(ctx));
+    free(output);
+    krrp_context_free(ctx);
+
+    if (ErrorCount != errors || atom_scope_contains_bind(ImportedSource, atom_name_new(strdup("N"))))
+        error("[FAIL] Context\n   :: Interpreting in a second context changed the first.\n");
+}
+
+// after a rollback to a checkpoint, the heap is as it was at the checkpoint
+void test_checkpoint() {
+    krrp_context *ctx = krrp_context_new();
+    krrp_prelude(ctx, "![sq]^n:*nn.", NULL);
+    krrp_checkpoint(ctx);
+    long live = ctx->mm.allocations - ctx->mm.deallocations;
+
+    for (int j = 0; j < 3; j++) {
+        char *output = krrp_eval(ctx, "\\L [sum][map];[sq][range]0$10.");
+        bool rolled_back = krrp_rollback(ctx);
+
+        if (!output || strcmp(output, "$285.\n") != 0 || !rolled_back || ctx->mm.allocations - ctx->mm.deallocations != live)
+            error("[FAIL] Checkpoint\n   :: Run %d printed '%s' and %s.\n", j, output ? output : "none",
+                rolled_back ? "left a different heap" : "could not be rolled back");
+        free(output);
+    }
+
+    krrp_context_free(ctx);
+}
+
+// a name the prelude binds is not folded as the built-in of that name
+void test_prelude_fold() {
+    for (int level = 0; level <= 1; level++) {
+        krrp_context *ctx = krrp_context_new();
+        krrp_options(ctx)->optimization_level = level;
+        krrp_prelude(ctx, "!+^ab:-ab.", NULL);
+        char *output = krrp_eval(ctx, "+56");
+
+        if (!output || strcmp(output, "$-1.\n") != 0)
+            error("[FAIL] Prelude \"+56\"\n   :: '%s' at optimization level %d differs from expected '$-1.'.\n",
+                output ? output : "none", level);
+        free(output);
+        krrp_context_free(ctx);
+    }
+}
+
+// an import binds function declarations lazily, which a rollback makes lazy again
+void test_lazy_import() {
+    krrp_context *ctx = krrp_context_new();
+    krrp_import(ctx, "N", "![sq]^n:*nn.\n![cube]^n:*n[sq]n.\n![id]^n:n.\n");
+    krrp_prelude(ctx, "![sq]^n:+nn. \\N", NULL);
+
+    krrp_context *previous = context_enter(ctx);
+    Atom *imported = ((ScopeAtom *) ctx->prelude->atom)->upper_scope;
+    Atom *cube = atom_scope_lookup_local(imported, atom_name_new(strdup("cube")));
+    Atom *id = atom_scope_lookup_local(imported, atom_name_new(strdup("id")));
+    context_leave(previous);
+
+    if (!atom_thunk_is(cube) || !atom_thunk_is(id)) {
+        error("[FAIL] Lazy imports\n   :: Function declarations were not bound lazily.\n");
+        krrp_context_free(ctx);
+        return;
+    }
+
+    krrp_checkpoint(ctx);
+    for (int j = 0; j < 2; j++) {
+        char *output = krrp_eval(ctx, "[cube]3 [sq]3");
+        bool forced = ((ThunkAtom *) cube->atom)->value && !((ThunkAtom *) id->atom)->value;
+        bool rolled_back = krrp_rollback(ctx) && !((ThunkAtom *) cube->atom)->value;
+
+        if (!output || strcmp(output, "$27.\n6\n") != 0 || !forced || !rolled_back)
+            error("[FAIL] Lazy imports\n   :: Run %d printed '%s' (expected '$27.\\n6\\n'), %s.\n", j, output ? output : "none",
+                !forced ? "forcing the wrong thunks" : !rolled_back ? "leaving a thunk forced" : "forcing the right thunks");
+        free(output);
+    }
+
+    krrp_context_free(ctx);
+}
+
+// a run exhausting a budget is stopped, the next one is not
+void test_budget() {
+    krrp_context *ctx = krrp_context_new();
+    Opt *opt = krrp_options(ctx);
+    opt->ERR = false;
+
+    struct { const char *source; krrp_budget budget; } runs[] = {
+        { "![fib]^n:?<n21+@-n1@-n2. [fib]$40.", krrp_budget_steps },
+        { "![l]^n:?nLn@-n1E. ![L]#Lfr. ![E]#E. [l]$500.", krrp_budget_bytes },
+        { "![fib]^n:?<n21+@-n1@-n2. [fib]$40.", krrp_budget_time }
+    };
+    for (int j = 0; j < 3; j++) {
+        opt->maximum_steps = runs[j].budget == krrp_budget_steps ? 10000 : 0;
+        opt->maximum_bytes = runs[j].budget == krrp_budget_bytes ? 10000 : 0;
+        opt->maximum_seconds = runs[j].budget == krrp_budget_time ? 1e-9 : 0;
+        char *output = krrp_eval(ctx, runs[j].source);
+
+        if (!output || !strstr(output, "ENull") || krrp_exhausted(ctx) != runs[j].budget || !opt->WRN)
+            error("[FAIL] Budget\n   :: Run %d printed '%s' and exhausted budget %d.\n", j,
+                output ? output : "none", krrp_exhausted(ctx));
+        free(output);
+    }
+
+    opt->maximum_seconds = 0;
+    opt->maximum_steps = 1000;
+    char *output = krrp_eval(ctx, "![sq]^n:*nn. [sq]$12.");
+    if (!output || strcmp(output, "$144.\n") != 0 || krrp_exhausted(ctx) != krrp_budget_none)
+        error("[FAIL] Budget\n   :: '%s' differs from expected '$144.\\n'.\n", output ? output : "none");
+    free(output);
+
+    krrp_context_free(ctx);
+}
+
+// flips the last byte of, or removes, every entry of a cache directory
+static void test_cache_entries(const char *directory, bool remove) {
+    DIR *entries = opendir(directory);
+    for (struct dirent *entry; entries && (entry = readdir(entries)); ) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        char path[4096];
+        snprintf(path, sizeof path, "%s/%s", directory, entry->d_name);
+        FILE *f = remove ? NULL : fopen(path, "r+b");
+        if (remove)
+            unlink(path);
+        else if (f && fseek(f, -1, SEEK_END) == 0) {
+            int c = fgetc(f);
+            fseek(f, -1, SEEK_END);
+            fputc(c ^ 1, f);
+        }
+        if (f)
+            fclose(f);
+    }
+    if (entries)
+        closedir(entries);
+}
+
+// a cached source is loaded instead of parsed, a corrupt entry is replaced
+void test_cache() {
+    char directory[] = "/tmp/krrp-test-cache-XXXXXX";
+    if (!mkdtemp(directory)) {
+        error("[FAIL] Cache\n   :: Could not create a directory.\n");
+        return;
+    }
+
+    krrp_context *ctx = krrp_context_new();
+    Opt *opt = krrp_options(ctx);
+    opt->cache_directory = directory;
+    opt->stats = true;
+    krrp_import(ctx, "N", "![sq]^n:*nn.\n![cube]^n:*n[sq]n.\n");
+
+    // hits and misses after each run, the entries being corrupted before the third
+    long expected[][2] = { { 0, 2 }, { 2, 2 }, { 2, 4 }, { 4, 4 } };
+    for (int j = 0; j < 4; j++) {
+        if (j == 2)
+            test_cache_entries(directory, false);
+
+        char *output = krrp_eval(ctx, "\\N [cube]3");
+        if (!output || strcmp(output, "$27.\n") != 0 || ctx->stats.cache_hits != expected[j][0] || ctx->stats.cache_misses != expected[j][1])
+            error("[FAIL] Cache\n   :: Run %d printed '%s' with %ld hits and %ld misses, expected '$27.\\n' with %ld and %ld.\n", j,
+                output ? output : "none", ctx->stats.cache_hits, ctx->stats.cache_misses, expected[j][0], expected[j][1]);
+        free(output);
+    }
+
+    krrp_context_free(ctx);
+    test_cache_entries(directory, true);
+    rmdir(directory);
+}
+
 void test_all() {
     Atom *T = atom_integer_new(1);
 
@@ -79,4 +454,46 @@ void test_all() {
     test("~An implementation of Peano naturals.\n !Z#Z.!S#Sp. ![->]^n:?nS@-n1Z. ![<-]^n:?#?Zn0+1@#!pn. ~TEST OVERLOADING HERE\n ![p+]^nm:?#?ZnmS@#!pnm. =[<-][p+][->]3[->]8$11.", T);
     test("![factorial]^n:?n*n@-n11. ![choose]^nk:!f;[factorial]/fn*fkf-nk. [choose]83", atom_integer_new(56));
     test("\\L [sum][map]^n:**nnn.[range]09", atom_integer_new(1296));
+    test("\\L [sum][pmap]^n:**nnn.[range]09", atom_integer_new(1296));
+    test("\\L [length][pfilter]^x:%x2.[range]0$11.", atom_integer_new(5));
+    test("\\L [preduce];*1[range]16", atom_integer_new(120));
+    test("?0?1$5.34", atom_integer_new(4));
+    test("++|07|37+&07&37", atom_integer_new(17));
+    test("!a5!b+a1 !f^n:*nb. f2", atom_integer_new(12));
+    test("!+^ab:*ab. +56", atom_integer_new(30));
+    test("!g^+:+56. g;-", atom_integer_new(-1));
+    test("!f^n:?n+n@-n1?1$0.1. f*23", atom_integer_new(21));
+    test("![sq]^n:*nn. ![f]^n:+[sq]n[sq]n. f7", atom_integer_new(98));
+    test("!x1 ![f]^n: ![k]^m:x. !a[k]0 !x5 +a[k]0. f0", atom_integer_new(6));
+    test("![h]^n:*n2. ![f]^gx:+[h]gx[h]gx. ![i]^n:+n1. f;i3", atom_integer_new(16));
+    test("\\T !kT3 4 ![g]^x:+x[fst]k. ![f]^k:[g]k. [f]$10.", atom_integer_new(13));
+    test("![g]^m: ![f]^n:?<nm n +@-n1@-n2. f$15.. g3", atom_integer_new(987));
+
+    test_kernel("![fib]^n:?<n21+@-n1@-n2.", "1: ? < p0 $2 $1 + @ - p0 $1 @ - p0 $2");
+    test_kernel("!g^ab:|&a-ab$-7..", "2: | & p0 - p0 p1 $-7");
+    test_kernel("!h^l:#!fl.", NULL);
+    test_kernel("!k^n:+nm.", "1: + p0 c0");
+    test_kernel("!k^n:[map]n.", NULL);
+    test_kernel_unbound();
+
+    // functions mixing integers with other values, or kernels applied to
+    // them, are interpreted instead
+    test_kernel("![m]^ln:?<n0#!fln.", NULL);
+    test("!C#Cfr. ![m]^ln:?<n0#!fln. +[m]C40 3[m]C40$-1.", atom_integer_new(7));
+    test_kernel("![i]^n:n.", "1: p0");
+    test("!C#Cfr. ![i]^n:n. +#!f[i]C40[i]3", atom_integer_new(7));
+
+    test_lazy();
+    test_struct_fields();
+    test_parse_quiet();
+    test_share();
+    test_inline();
+    test_unbox();
+    test_parallel();
+    test_context();
+    test_checkpoint();
+    test_prelude_fold();
+    test_lazy_import();
+    test_budget();
+    test_cache();
 }
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trace.h"
+#include "profile.h"
+#include "debug.h"
+
+
+/* Chrome trace-event export (`--trace`)
+
+    Spans are recorded as complete ("X") events into a fixed ring of
+    unformatted events; only when the ring is full is it drained, i.e.
+    formatted and written to the trace file in one go. User function
+    applications are sampled, one in every `sample` being traced; imports,
+    parses and top-level statements are always traced. A function span is
+    named after the function's bound name, which is resolved when the event
+    is drained. The resulting file loads into chrome://tracing or Perfetto. */
+
+#define TRACE_RING 8192
+
+typedef struct { const char *category, *name; AtomList *body; long index; double start, duration; } TraceEvent;
+
+struct TraceState {
+    FILE *f;
+    const char *separator;
+    long sample, countdown;
+    double origin;
+
+    TraceEvent ring[TRACE_RING];
+    long size;
+};
+
+// the context's trace, allocated when it is opened
+#define Trace (*GlobContext->trace)
+
+
+static double trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+static void trace_write_string(const char *str) {
+    fputc('"', Trace.f);
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\')
+            fprintf(Trace.f, "\\%c", c);
+        else if (c < 32 || c >= 127)
+            fprintf(Trace.f, "\\u%04x", c);
+        else
+            fputc(c, Trace.f);
+    }
+    fputc('"', Trace.f);
+}
+
+static void trace_drain() {
+    for (long j = 0; j < Trace.size; j++) {
+        TraceEvent *e = &Trace.ring[j];
+
+        fprintf(Trace.f, "%s{\"name\": ", Trace.separator);
+        trace_write_string(e->body ? profile_function_name(e->body) : e->name);
+        fprintf(Trace.f, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": 1",
+            e->category, e->start - Trace.origin, e->duration);
+        if (e->index > 0)
+            fprintf(Trace.f, ", \"args\": {\"index\": %ld}", e->index);
+        fprintf(Trace.f, "}");
+        Trace.separator = ",\n";
+    }
+
+    Trace.size = 0;
+}
+
+
+bool trace_open(const char *filename, long sample) {
+    if (!GlobContext->trace && !(GlobContext->trace = calloc(1, sizeof *GlobContext->trace)))
+        return error("trace :: Out of memory.\n"), false;
+
+    if (!(Trace.f = fopen(filename, "w")))
+        return error("trace :: Could not open `%s` for writing.\n", filename), false;
+
+    Trace.separator = "";
+    Trace.sample = Trace.countdown = sample > 0 ? sample : 1;
+    Trace.origin = trace_now();
+    Trace.size = 0;
+
+    fprintf(Trace.f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    return true;
+}
+
+// the start of a span which is always traced
+double trace_begin() {
+    return trace_now();
+}
+
+// the start of a sampled span, or a negative value if it is not to be traced
+double trace_begin_sampled() {
+    if (!GlobContext->trace || --Trace.countdown > 0)
+        return -1;
+
+    Trace.countdown = Trace.sample;
+    return trace_now();
+}
+
+// records a span; function spans pass their body, others a name and
+// optionally a positive index
+void trace_span(const char *category, const char *name, AtomList *body, long index, double start) {
+    if (start < 0 || !GlobContext->trace || !Trace.f)
+        return;
+
+    if (Trace.size >= TRACE_RING)
+        trace_drain();
+
+    Trace.ring[Trace.size++] = (TraceEvent) {
+        .category = category,
+        .name = name,
+        .body = body,
+        .index = index,
+        .start = start,
+        .duration = trace_now() - start
+    };
+}
+
+bool trace_close() {
+    if (!GlobContext->trace || !Trace.f)
+        return false;
+
+    trace_drain();
+    fprintf(Trace.f, "\n]}\n");
+
+    bool closed = fclose(Trace.f) == 0;
+    free(GlobContext->trace);
+    GlobContext->trace = NULL;
+    return closed;
+}
@@ -0,0 +1,15 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+#include "atomlist.h"
+
+
+bool trace_open(const char *filename, long sample);
+double trace_begin();
+double trace_begin_sampled();
+void trace_span(const char *category, const char *name, AtomList *body, long index, double start);
+bool trace_close();
+
+#endif
@@ -18,6 +18,10 @@ typedef struct PrimitiveAtom PrimitiveAtom;
 typedef struct FunctionDeclarationAtom FunctionDeclarationAtom;
 typedef struct FunctionAtom FunctionAtom;
 typedef struct ScopeAtom ScopeAtom;
+typedef struct ThunkAtom ThunkAtom;
+typedef struct SharedAtom SharedAtom;
+typedef struct InlineAtom InlineAtom;
+typedef struct UnboxedAtom UnboxedAtom;
 typedef struct StructInitializerAtom StructInitializerAtom;
 typedef struct StructAtom StructAtom;
 typedef struct StringAtom StringAtom;
@@ -27,6 +31,9 @@ typedef struct ListAtom ListAtom;
 typedef struct AtomList AtomList;
 typedef struct AtomListNode AtomListNode;
 
+// what optimizing a lazily parsed body knows of its surroundings
+typedef struct OptimizeScope OptimizeScope;
+
 
 // atom types
 typedef enum {
@@ -42,6 +49,10 @@ typedef enum {
     atom_type_functiondeclaration,
     atom_type_function,
     atom_type_scope,
+    atom_type_thunk,
+    atom_type_shared,
+    atom_type_inline,
+    atom_type_unboxed,
 
     atom_type_structinitializer,
     atom_type_struct,
@@ -50,4 +61,24 @@ typedef enum {
     atom_type_list
 } atom_type;
 
+
+// primitive function opcodes
+typedef enum {
+    primitive_none,
+
+    primitive_modulo,
+    primitive_multiply,
+    primitive_add,
+    primitive_subtract,
+    primitive_divide,
+    primitive_less,
+    primitive_equal,
+    primitive_greater,
+
+    // higher-order list combinators, see parallel.c
+    primitive_pmap,
+    primitive_pfilter,
+    primitive_preduce
+} primitive_opcode;
+
 #endif